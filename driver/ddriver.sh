@@ -3,10 +3,12 @@ ORIGIN_WORK_DIR="$PWD"
 
 KERNEL_DDRIVER="./kernel_ddriver"
 KERNEL_DEV_PATH="/dev/ddriver"
+KERNEL_BLK_PATH="/dev/ddriverb"
 
 USER_DDRIVER="./user_ddriver"
 USER_LOG_PATH="$HOME/ddriver_log"
 USER_DEV_PATH="$HOME/ddriver"
+USER_SHM_PATH="/dev/shm/ddriver-$(id -u)"
 
 
 if [ -L "$0" ]; then
@@ -38,6 +40,7 @@ function usage(){
     echo "-t            测试ddriver[请忽略]"
     echo "-d            导出ddriver至当前工作目录[PWD]"
     echo "-r            擦除ddriver"
+    echo "-s [image]    以模板镜像(如格式化好的ddriver_dump)重置ddriver"
     echo "-l            显示ddriver的Log"
     echo "-v            显示ddriver的类型[内核模块 / 用户静态链接库]"
     echo "-h            打印本帮助菜单"
@@ -159,13 +162,35 @@ function clean(){
         sudo dd if=/dev/zero of=$KERNEL_DEV_PATH bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
     else
         echo "目标设备 $USER_DEV_PATH"
-        dd if=/dev/zero of="$USER_DEV_PATH" bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
+        # 对整个镜像打洞，与镜像大小无关；不支持打洞的文件系统上退回写0
+        fallocate -p -o 0 -l "$(stat -c %s "$USER_DEV_PATH")" "$USER_DEV_PATH" 2>/dev/null \
+            || dd if=/dev/zero of="$USER_DEV_PATH" bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT conv=notrunc
+        rm -f "$USER_SHM_PATH"               # shm后端残留的共享内存段(进程异常退出时)
+    fi 
+}
+
+function restore(){
+    TEMPLATE=$(cd "$ORIGIN_WORK_DIR" && readlink -f "$1")
+    if [ ! -f "$TEMPLATE" ]; then
+        echo "模板镜像 $1 不存在"
+        exit 1
+    fi
+    if [ "$DDRIVER_TYPE" == "k" ]; then  
+        echo "目标设备 $KERNEL_DEV_PATH"
+        sudo dd if="$TEMPLATE" of=$KERNEL_DEV_PATH bs=$CONFIG_BLOCK_SZ
+    else
+        echo "目标设备 $USER_DEV_PATH"
+        # 支持reflink的文件系统上只共享数据块，不拷贝数据
+        cp --reflink=auto --sparse=always "$TEMPLATE" "$USER_DEV_PATH"
     fi 
 }
 
 function version () {
     if [ "$DDRIVER_TYPE" == "k" ]; then  
         echo "内核设备: $KERNEL_DEV_PATH"
+        if [ -b "$KERNEL_BLK_PATH" ]; then
+            echo "内核块设备: $KERNEL_BLK_PATH"
+        fi
     else
         echo "静态链接库设备: $USER_DEV_PATH"
     fi 
@@ -174,7 +199,7 @@ function version () {
 if [ $# == 0 ]; then
     usage
 else 
-    while getopts 'i:tdhrlv' OPT; do
+    while getopts 'i:tdhrs:lv' OPT; do
         case $OPT in
             i) install "$OPTARG"
             ;;
@@ -184,6 +209,8 @@ else
             ;;
             r) clean
             ;;
+            s) restore "$OPTARG"
+            ;;
             l) log
             ;;
             v) version 
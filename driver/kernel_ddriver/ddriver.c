@@ -2,6 +2,14 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/fs.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/highmem.h>
+#include <linux/version.h>
+#include <linux/uio.h>
 #include <asm/uaccess.h>
 #include <linux/uaccess.h>
 #include "ddriver_ctl.h"
@@ -9,6 +17,7 @@
 * SECTION: Macro definitions
 *******************************************************************************/
 #define DEVICE_NAME   "ddriver"
+#define BLK_DEVICE_NAME "ddriverb"                    /* 块设备，/dev/ddriverb */
 #define kernel_info(fmt, ...)                                           \
 	do {                                                                \
 		printk(KERN_INFO DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);      \
@@ -29,21 +38,21 @@
 
 #define CONFIG_DISK_SZ  (4 * 1024 * 1024)
 #define CONFIG_BLOCK_SZ (512)
+#define CONFIG_QDEPTH   (128)
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
 #define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#define IS_ADDR_ALIGN(addr)     (addr % disk.iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     ((addr / disk.iounit_size) * disk.iounit_size)
 
-#define GET_HEAD_POS(disk)      (disk.head - disk.layout)
-#define FORWARD_HEAD(disk, dis) (disk.head += dis)
-#define SET_HEAD(disk, ofs)     (disk.head = disk.layout + ofs)
-#define RESET_HEAD(disk)        (SET_HEAD(disk, 0))
+#define IS_SIZE_ALIGN(size)     (size % disk.iounit_size == 0)
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+#define INC_READCNT(disk)       (atomic_inc(&disk.read_cnt))
+#define INC_WRITECNT(disk)      (atomic_inc(&disk.write_cnt))
+#define INC_SEEKCNT(disk)       (atomic_inc(&disk.seek_cnt))
+#define ADD_READCNT(disk, n)    (atomic_add(n, &disk.read_cnt))
+#define ADD_WRITECNT(disk, n)   (atomic_add(n, &disk.write_cnt))
 /******************************************************************************
 * SECTION: Kernel Module Template
 *******************************************************************************/
@@ -51,43 +60,72 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR(DRIVER_AUTHOR);	    
 MODULE_DESCRIPTION(DRIVER_DESC);	
 MODULE_VERSION(DRIVER_VERSION);	
+
+static unsigned long disk_size = CONFIG_DISK_SZ;
+module_param(disk_size, ulong, 0444);
+MODULE_PARM_DESC(disk_size, "Device size in bytes, multiple of block_size");
+static int block_size = CONFIG_BLOCK_SZ;
+module_param(block_size, int, 0444);
+MODULE_PARM_DESC(block_size, "IO unit in bytes, power of two in [512, 65536]");
+static bool blkdev = true;
+module_param(blkdev, bool, 0444);
+MODULE_PARM_DESC(blkdev, "Also register the layout as blk-mq block device /dev/" BLK_DEVICE_NAME);
+static int nr_hw_queues = 0;
+module_param(nr_hw_queues, int, 0444);
+MODULE_PARM_DESC(nr_hw_queues, "Hardware queues of the block device, 0 for one per CPU");
+static int queue_depth = CONFIG_QDEPTH;
+module_param(queue_depth, int, 0444);
+MODULE_PARM_DESC(queue_depth, "Tags per hardware queue of the block device");
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
 struct ddriver
 {
-    char layout[CONFIG_DISK_SZ];                      /* Disk Layout */
-    char *head;                                       /* Disk Head */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
+    char *layout;                                     /* Disk Layout, vmalloc_user-ed, mmap-able */
+    atomic_t read_cnt;                                /* 字符设备与块设备共用 */
+    atomic_t write_cnt;
+    atomic_t seek_cnt;
     int  major_num;
-    int  open_count;
-    int  layout_size;
+    int  blk_major;
+    struct blk_mq_tag_set tag_set;
+    struct gendisk *gdisk;                            /* 与字符设备共享layout */
+    atomic_t open_count;
+    loff_t layout_size;
     int  iounit_size;
 };
 
 static struct ddriver disk = {
-    .head        = NULL,
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
+    .layout      = NULL,
+    .read_cnt    = ATOMIC_INIT(0),
+    .write_cnt   = ATOMIC_INIT(0),
+    .seek_cnt    = ATOMIC_INIT(0),
     .major_num   = 0,
-    .open_count  = 0,
+    .blk_major   = 0,
+    .gdisk       = NULL,
+    .open_count  = ATOMIC_INIT(0),
     .layout_size = CONFIG_DISK_SZ,
     .iounit_size = CONFIG_BLOCK_SZ
 };
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
-int check_valid(size_t size){
-    if (GET_HEAD_POS(disk) >=  CONFIG_DISK_SZ) {
-        kernel_alert("disk head reach the end");
+/**
+ * @brief 校验一次传输：位置与大小须与IO单位对齐，到达设备末尾时截断
+ * 
+ * @param pos           Position of the open file
+ * @param size          Bytes requested, updated to bytes available
+ * @return int          0 or error
+ */
+int check_valid(loff_t pos, size_t *size){
+    if (!IS_ADDR_ALIGN(pos) || !IS_SIZE_ALIGN(*size)) {
+        kernel_alert("io [%lld, +%zu) should align to %d", pos, *size, disk.iounit_size);
         return -EINVAL;
     }
-    if (size != CONFIG_BLOCK_SZ){
-        kernel_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
-        return -EIO;
+    if (pos >= disk.layout_size) {
+        *size = 0;
+    }
+    else if (*size > disk.layout_size - pos) {
+        *size = disk.layout_size - pos;
     }
     return 0;
 }
@@ -96,132 +134,166 @@ int check_valid(size_t size){
 *******************************************************************************/
 static int      device_open(struct inode *, struct file *);
 static int      device_release(struct inode *, struct file *);
-static ssize_t  device_read(struct file *, char *, size_t, loff_t *);
-static ssize_t  device_write(struct file *, const char *, size_t, loff_t *);
+static ssize_t  device_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t  device_write_iter(struct kiocb *, struct iov_iter *);
 static loff_t   device_seek(struct file *, loff_t, int);
 static long     device_ioctl(struct file *, unsigned int, unsigned long);
+static int      device_mmap(struct file *, struct vm_area_struct *);
 /******************************************************************************
 * SECTION: Global var or structure definitions
 *******************************************************************************/
 static struct file_operations file_ops = {
-    .read = device_read,
-    .write = device_write,
+    .read_iter = device_read_iter,
+    .write_iter = device_write_iter,
     .open = device_open,
     .llseek = device_seek,
     .unlocked_ioctl = device_ioctl,
+    .mmap = device_mmap,
     .release = device_release
 };
 /******************************************************************************
 * SECTION: Function Implementation
 *******************************************************************************/
 /**
- * @brief Disk Read
+ * @brief Disk Read，read/readv/pread均走这里，一次可读出多个IO单位
  * 
- * @param file          Ignored
- * @param user_buffer   User space buffer
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
- * @param offset        Ignored
+ * @param iocb          Position in iocb->ki_pos, one per open file
+ * @param to            User space buffers
  * @return ssize_t      Bytes have been read 
  */
 static ssize_t 
-device_read(struct file *file, char *user_buffer, size_t size, loff_t *offset) {
-    IGNORE_ARG(offset);
-    IGNORE_ARG(file);
-    int res = check_valid(size);
+device_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    size_t size = iov_iter_count(to);
+    size_t copied;
+    int res = check_valid(iocb->ki_pos, &size);
     if(res < 0)
         return res;
-    if (copy_to_user(user_buffer, disk.head, CONFIG_BLOCK_SZ))
+    if (size == 0)
+        return 0;
+
+    copied = copy_to_iter(disk.layout + iocb->ki_pos, size, to);
+    if (copied == 0)
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    iocb->ki_pos += copied;
+    ADD_READCNT(disk, copied / disk.iounit_size);
+    return copied;
 }
 /**
- * @brief Disk Write
+ * @brief Disk Write，write/writev/pwrite均走这里，一次可写入多个IO单位
  * 
- * @param file          Ignored
- * @param user_buffer   User space buffer, copy content from
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
- * @param offset        Ignored
+ * @param iocb          Position in iocb->ki_pos, one per open file
+ * @param from          User space buffers, copy content from
  * @return ssize_t      Bytes have been written
  */
 static ssize_t 
-device_write(struct file *file, const char *user_buffer, size_t size, loff_t *offset) {
-    IGNORE_ARG(offset);
-    IGNORE_ARG(file);
-    int res = check_valid(size);
+device_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    size_t size = iov_iter_count(from);
+    size_t copied;
+    int res = check_valid(iocb->ki_pos, &size);
     if(res < 0)
         return res;
+    if (size == 0)
+        return -ENOSPC;
 
-    if (copy_from_user(disk.head, user_buffer, CONFIG_BLOCK_SZ))
+    copied = copy_from_iter(disk.layout + iocb->ki_pos, size, from);
+    if (copied == 0)
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    iocb->ki_pos += copied;
+    ADD_WRITECNT(disk, copied / disk.iounit_size);
+    return copied;
 }
 /**
  * @brief Disk Seek
  * 
- * @param file          Ignored
+ * @param file          Position kept in file->f_pos
  * @param offset        Aligned to @CONFIG_BLOCK_SZ
- * @param whence        SEEK_CUR, SEEK_SET
+ * @param whence        SEEK_CUR, SEEK_SET, SEEK_END
  * @return loff_t       cur pos
  */
 static loff_t 
 device_seek(struct file *file, loff_t offset, int whence) {
-    IGNORE_ARG(file);
+    loff_t pos;
+
     if (!IS_ADDR_ALIGN(offset)) {
         kernel_alert("offset %lld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk.iounit_size);
         return -EINVAL;
     }
     switch (whence)
     {
     case SEEK_SET:
-        SET_HEAD(disk, offset);
+        pos = offset;
         break;
     case SEEK_CUR:
-        FORWARD_HEAD(disk, offset);
+        pos = file->f_pos + offset;
         break;
-    default:
+    case SEEK_END:
+        pos = disk.layout_size + offset;
         break;
+    default:
+        return -EINVAL;
+    }
+    if (pos < 0 || pos > disk.layout_size) {
+        return -EINVAL;
     }
+    file->f_pos = pos;
     INC_SEEKCNT(disk);
-    return GET_HEAD_POS(disk);
+    return pos;
 }
 /**
  * @brief Disk ioctl
  * 
- * @param file          Ignored
+ * @param file          RESET rewinds its position
  * @param cmd           Command
  * @param arg           Args
  * @return long         State
  */
 static long 
 device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
-    IGNORE_ARG(file);
     int ret;
+    int size;
+    long long size64;
     struct ddriver_state state;
+    struct ddriver_discard range;
     switch (cmd)
     {
-    case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        ret = copy_to_user((int __user *)arg, &disk.layout_size, sizeof(int));
+    case IOC_REQ_DEVICE_SIZE:                         /* Device Size, clamp to int */
+        size = disk.layout_size > INT_MAX ? ADDR_ROUND_UP(INT_MAX) : disk.layout_size;
+        ret = copy_to_user((int __user *)arg, &size, sizeof(int));
+        if (ret) 
+            return -EFAULT;
+        break;
+    case IOC_REQ_DEVICE_SIZE64:                       /* Device Size, 64 bit */
+        size64 = disk.layout_size;
+        ret = copy_to_user((long long __user *)arg, &size64, sizeof(long long));
         if (ret) 
             return -EFAULT;
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        state.read_cnt = atomic_read(&disk.read_cnt);
+        state.write_cnt = atomic_read(&disk.write_cnt);
+        state.seek_cnt = atomic_read(&disk.seek_cnt);
         ret = copy_to_user((int __user *)arg, &state, sizeof(struct ddriver_state));
         if (ret) 
             return -EFAULT;
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        disk.head = disk.layout;
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        file->f_pos = 0;
+        atomic_set(&disk.read_cnt, 0);
+        atomic_set(&disk.write_cnt, 0);
+        atomic_set(&disk.seek_cnt, 0);
+        break;
+    case IOC_REQ_DEVICE_DISCARD:                      /* Discard (TRIM), zero the range */
+        ret = copy_from_user(&range, (struct ddriver_discard __user *)arg, 
+                             sizeof(struct ddriver_discard));
+        if (ret) 
+            return -EFAULT;
+        if (range.len <= 0 || !IS_ADDR_ALIGN(range.offset) || !IS_ADDR_ALIGN(range.len)
+            || range.offset < 0 || range.offset + range.len > disk.layout_size) {
+            kernel_alert("discard [%lld, +%lld) invalid", range.offset, range.len);
+            return -EINVAL;
+        }
+        memset(disk.layout + range.offset, 0, range.len);
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         ret = copy_to_user((int __user *)arg, &disk.iounit_size, sizeof(int));
@@ -234,22 +306,40 @@ device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
     return 0;
 }
 /**
- * @brief Disk Open
+ * @brief Disk mmap，把layout直接映射到用户态，读写元数据无需拷贝
+ * 
+ * 经映射的访存不经过read/write，不计入read_cnt/write_cnt
  * 
- * @param inode         Ignored
  * @param file          Ignored
+ * @param vma           vm_pgoff为页偏移，映射范围不得越过layout
+ * @return int          state
+ */
+static int 
+device_mmap(struct file *file, struct vm_area_struct *vma) {
+    unsigned long len = vma->vm_end - vma->vm_start;
+    loff_t offset = (loff_t)vma->vm_pgoff << PAGE_SHIFT;
+    IGNORE_ARG(file);
+
+    if (offset >= disk.layout_size || len > disk.layout_size - offset) {
+        kernel_alert("mmap [%lld, +%lu) exceeds disk size %lld", 
+                      offset, len, disk.layout_size);
+        return -EINVAL;
+    }
+    return remap_vmalloc_range(vma, disk.layout, vma->vm_pgoff);
+}
+/**
+ * @brief Disk Open，每个打开的文件有独立的位置，允许多次打开
+ * 
+ * @param inode         Ignored
+ * @param file          Position starts at 0
  * @return int          state
  */
 static int 
 device_open(struct inode *inode, struct file *file) {
     IGNORE_ARG(inode);
-    IGNORE_ARG(file);
     
-    if (disk.open_count) {                            /* If device is open, return busy */
-        return -EBUSY;
-    }
-    RESET_HEAD(disk);                                 /* Everytime close device, reset head */
-    disk.open_count++;
+    file->f_pos = 0;
+    atomic_inc(&disk.open_count);
     try_module_get(THIS_MODULE);
     return 0;
 }
@@ -266,27 +356,213 @@ device_release(struct inode *inode, struct file *file) {
                                                          Without this, the module would not unload. */
     IGNORE_ARG(inode);
     IGNORE_ARG(file);
-    disk.open_count--;
+    atomic_dec(&disk.open_count);
     module_put(THIS_MODULE);
     return 0;
 }
 /******************************************************************************
+* SECTION: Block Device (blk-mq)
+*******************************************************************************/
+/**
+ * @brief 服务一个request：逐段在layout与bio页之间拷贝，各硬件队列并发执行
+ * 
+ * @param hctx          Ignored
+ * @param bd            Request
+ * @return blk_status_t 
+ */
+static blk_status_t 
+ddriver_queue_rq(struct blk_mq_hw_ctx *hctx, const struct blk_mq_queue_data *bd) {
+    struct request *rq = bd->rq;
+    loff_t pos = (loff_t)blk_rq_pos(rq) << SECTOR_SHIFT;
+    blk_status_t status = BLK_STS_OK;
+    struct req_iterator iter;
+    struct bio_vec bvec;
+    void *buf;
+    IGNORE_ARG(hctx);
+
+    blk_mq_start_request(rq);
+    if (pos + blk_rq_bytes(rq) > disk.layout_size) {
+        kernel_alert("request [%lld, +%u) out of device", pos, blk_rq_bytes(rq));
+        blk_mq_end_request(rq, BLK_STS_IOERR);
+        return BLK_STS_OK;
+    }
+
+    switch (req_op(rq))
+    {
+    case REQ_OP_READ:
+    case REQ_OP_WRITE:
+        rq_for_each_segment(bvec, rq, iter) {
+            buf = bvec_kmap_local(&bvec);
+            if (req_op(rq) == REQ_OP_WRITE) {
+                memcpy(disk.layout + pos, buf, bvec.bv_len);
+            }
+            else {
+                memcpy(buf, disk.layout + pos, bvec.bv_len);
+            }
+            kunmap_local(buf);
+            pos += bvec.bv_len;
+        }
+        if (req_op(rq) == REQ_OP_WRITE) {
+            ADD_WRITECNT(disk, blk_rq_bytes(rq) / disk.iounit_size);
+        }
+        else {
+            ADD_READCNT(disk, blk_rq_bytes(rq) / disk.iounit_size);
+        }
+        break;
+    case REQ_OP_DISCARD:
+    case REQ_OP_WRITE_ZEROES:
+        memset(disk.layout + pos, 0, blk_rq_bytes(rq));
+        break;
+    case REQ_OP_FLUSH:                                /* 内存介质，无易失缓存 */
+        break;
+    default:
+        status = BLK_STS_NOTSUPP;
+        break;
+    }
+    blk_mq_end_request(rq, status);
+    return BLK_STS_OK;
+}
+
+static const struct blk_mq_ops ddriver_mq_ops = {
+    .queue_rq = ddriver_queue_rq,
+};
+
+static const struct block_device_operations ddriver_blk_ops = {
+    .owner = THIS_MODULE,
+};
+/**
+ * @brief 注册blk-mq块设备，逻辑块大小取block_size(不超过PAGE_SIZE)
+ * 
+ * @return int          state
+ */
+static int 
+ddriver_blk_init(void) {
+    struct gendisk *gdisk;
+    unsigned int lbs = min_t(unsigned int, disk.iounit_size, PAGE_SIZE);
+    int ret;
+
+    disk.blk_major = register_blkdev(0, BLK_DEVICE_NAME);
+    if (disk.blk_major < 0) {
+        kernel_alert("Can't register block device, ret %d", disk.blk_major);
+        ret = disk.blk_major;
+        disk.blk_major = 0;
+        return ret;
+    }
+
+    memset(&disk.tag_set, 0, sizeof(disk.tag_set));
+    disk.tag_set.ops          = &ddriver_mq_ops;
+    disk.tag_set.nr_hw_queues = nr_hw_queues > 0 ? nr_hw_queues : num_online_cpus();
+    disk.tag_set.queue_depth  = queue_depth > 0 ? queue_depth : CONFIG_QDEPTH;
+    disk.tag_set.numa_node    = NUMA_NO_NODE;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+    disk.tag_set.flags        = BLK_MQ_F_SHOULD_MERGE;
+#endif
+    ret = blk_mq_alloc_tag_set(&disk.tag_set);
+    if (ret) {
+        kernel_alert("Can't allocate tag set, ret %d", ret);
+        goto out_unregister;
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+    {
+        struct queue_limits lim = {
+            .logical_block_size     = lbs,
+            .physical_block_size    = disk.iounit_size,
+            .max_hw_discard_sectors = UINT_MAX >> SECTOR_SHIFT,
+        };
+        gdisk = blk_mq_alloc_disk(&disk.tag_set, &lim, NULL);
+    }
+#else
+    gdisk = blk_mq_alloc_disk(&disk.tag_set, NULL);
+    if (!IS_ERR(gdisk)) {
+        blk_queue_logical_block_size(gdisk->queue, lbs);
+        blk_queue_physical_block_size(gdisk->queue, disk.iounit_size);
+        blk_queue_max_discard_sectors(gdisk->queue, UINT_MAX >> SECTOR_SHIFT);
+    }
+#endif
+    if (IS_ERR(gdisk)) {
+        ret = PTR_ERR(gdisk);
+        kernel_alert("Can't allocate disk, ret %d", ret);
+        goto out_free_tag_set;
+    }
+
+    gdisk->major        = disk.blk_major;
+    gdisk->first_minor  = 0;
+    gdisk->minors       = 1;
+    gdisk->fops         = &ddriver_blk_ops;
+    gdisk->private_data = &disk;
+    snprintf(gdisk->disk_name, DISK_NAME_LEN, BLK_DEVICE_NAME);
+    set_capacity(gdisk, disk.layout_size >> SECTOR_SHIFT);
+
+    ret = add_disk(gdisk);
+    if (ret) {
+        kernel_alert("Can't add disk, ret %d", ret);
+        put_disk(gdisk);
+        goto out_free_tag_set;
+    }
+    disk.gdisk = gdisk;
+    kernel_info("block device /dev/%s: %lld bytes, %d hw queues", 
+                BLK_DEVICE_NAME, disk.layout_size, disk.tag_set.nr_hw_queues);
+    return 0;
+
+out_free_tag_set:
+    blk_mq_free_tag_set(&disk.tag_set);
+out_unregister:
+    unregister_blkdev(disk.blk_major, BLK_DEVICE_NAME);
+    disk.blk_major = 0;
+    return ret;
+}
+
+static void 
+ddriver_blk_exit(void) {
+    if (disk.gdisk == NULL) {
+        return;
+    }
+    del_gendisk(disk.gdisk);
+    put_disk(disk.gdisk);
+    blk_mq_free_tag_set(&disk.tag_set);
+    unregister_blkdev(disk.blk_major, BLK_DEVICE_NAME);
+    disk.gdisk = NULL;
+}
+/******************************************************************************
 * SECTION: Module Register and Unregister
 *******************************************************************************/
 static int __init 
 ddriver_init(void)
 {
-    int major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
+    int major_num;
+
+    if (block_size < CONFIG_BLOCK_SZ || block_size > 65536 
+        || (block_size & (block_size - 1)) != 0) {
+        kernel_alert("invalid block_size %d", block_size);
+        return -EINVAL;
+    }
+    if (disk_size == 0 || disk_size % block_size != 0) {
+        kernel_alert("disk_size %lu should be multiple of %d", disk_size, block_size);
+        return -EINVAL;
+    }
+    disk.layout = vmalloc_user(disk_size);            /* Zeroed, and mappable by device_mmap */
+    if (disk.layout == NULL) {
+        kernel_alert("Can't allocate %lu bytes", disk_size);
+        return -ENOMEM;
+    }
+    disk.layout_size = disk_size;
+    disk.iounit_size = block_size;
+
+    major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
                                                       /* Register an device */
     if (major_num < 0) {                              /* Register fail */
         kernel_alert("Can't register device, ret %d", major_num);
+        vfree(disk.layout);
         return major_num;
     } 
     else {                                            /* Register success */                                                  
         kernel_info("module loaded with device major number %d", major_num);
         disk.major_num = major_num;
-        memset(disk.layout, 0, CONFIG_DISK_SZ);
-        return 0;
+    }
+
+    if (blkdev && ddriver_blk_init() != 0) {          /* 块设备注册失败不影响字符设备 */
+        kernel_alert("block device disabled");
     }
     return 0;
 }
@@ -296,9 +572,11 @@ ddriver_exit(void)
 {   
     int major_num = disk.major_num;
     kernel_info("Goodbye %d", major_num);
+    ddriver_blk_exit();
     if(major_num != 0){
         unregister_chrdev(major_num, DEVICE_NAME);
     }
+    vfree(disk.layout);
 }
 
 module_init(ddriver_init);
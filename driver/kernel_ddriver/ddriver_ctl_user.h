@@ -13,9 +13,59 @@ struct ddriver_state
     int seek_cnt;
 };
 
-#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
-#define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
-#define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
-#define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define DDRIVER_HIST_BUCKETS    32
+struct ddriver_stats
+{
+    long long read_ops;                         /* 读请求数(一次多块读计一次) */
+    long long write_ops;                        /* 写请求数 */
+    long long seek_ops;                         /* 磁头移动次数，同seek_cnt */
+    long long read_bytes;                       /* 读出字节数 */
+    long long write_bytes;                      /* 写入字节数 */
+    long long seek_distance;                    /* 磁头累计移动距离(字节) */
+    long long seq_ops;                          /* 紧接上一次传输结尾的请求数 */
+    long long rand_ops;                         /* 其余请求数 */
+    long long read_ns;                          /* 读请求累计模拟耗时(纳秒，含寻道) */
+    long long write_ns;                         /* 写请求累计模拟耗时 */
+    long long discard_ops;                      /* 丢弃请求数 */
+    long long discard_bytes;                    /* 丢弃字节数 */
+    long long cached_writes;                    /* 被写缓存吸收的写请求数 */
+    long long cached_reads;                     /* 完全由写缓存返回的读请求数 */
+    long long flush_ops;                        /* 写缓存写回次数 */
+    long long flash_read_pages;                 /* 闪存页读次数，含盘内读改写与GC搬移(仅ssd模型) */
+    long long flash_prog_bytes;                 /* 闪存编程字节数，除以write_bytes即写放大 */
+    long long flash_gc_pages;                   /* GC搬移的有效页数 */
+    long long flash_erases;                     /* 擦除块次数 */
+    long long flash_gc_ns;                      /* GC造成的写停顿(纳秒)，已计入write_ns */
+    long long read_hist[DDRIVER_HIST_BUCKETS];  /* 读延迟直方图，第i桶为[2^i, 2^(i+1))微秒 */
+    long long write_hist[DDRIVER_HIST_BUCKETS]; /* 写延迟直方图 */
+};
+
+struct ddriver_discard
+{
+    long long offset;                           /* 与设备IO单位对齐 */
+    long long len;                              /* 设备IO单位的整数倍 */
+};
+
+#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)                     /* 请求查看设备大小 */
+#define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)    /* 请求设备状态，返回 ddriver_state */
+#define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)                           /* 请求重置设备 */
+#define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)                     /* 请求设备IO大小 */
+#define IOC_REQ_DEVICE_BACKEND  _IOW(IOC_MAGIC, 4, int)                     /* 切换设备后端，参数为 DDRIVER_BACKEND_* */
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 5)                           /* 请求将设备内容刷写至后备文件(shm后端写回镜像) */
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 6, long long)               /* 请求查看设备大小(64位)，超过2GB的设备须使用 */
+#define IOC_REQ_DEVICE_LAT_MODE _IOW(IOC_MAGIC, 7, int)                     /* 切换延迟模拟方式，参数为 DDRIVER_LAT_* */
+#define IOC_REQ_DEVICE_CLOCK    _IOR(IOC_MAGIC, 8, long long)               /* 请求累计的模拟磁盘时间(纳秒) */
+#define IOC_REQ_DEVICE_STATS    _IOR(IOC_MAGIC, 9, struct ddriver_stats)    /* 请求扩展统计，返回 ddriver_stats */
+#define IOC_REQ_DEVICE_STATS_RESET _IO(IOC_MAGIC, 10)                       /* 只清零计数与统计，不擦除磁盘 */
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 11, struct ddriver_discard) /* 丢弃一段区域(TRIM)，之后读出为0 */
+#define IOC_REQ_DEVICE_RESET_FROM _IOW(IOC_MAGIC, 12, char *)              /* 以模板镜像重置设备，参数为模板路径(仅用户态驱动) */
+#define IOC_REQ_DEVICE_WCACHE   _IOW(IOC_MAGIC, 13, long long)              /* 设置易失写缓存大小(字节)，0为关闭，调整前先写回 */
+
+#define DDRIVER_BACKEND_FILE    0                                           /* 每次IO一次系统调用 */
+#define DDRIVER_BACKEND_MMAP    1                                           /* 映射整个镜像，IO即memcpy */
+
+#define DDRIVER_LAT_SLEEP       0                                           /* 按模拟延迟真实睡眠(默认) */
+#define DDRIVER_LAT_VIRTUAL     1                                           /* 不睡眠，仅累加虚拟时钟 */
+#define DDRIVER_LAT_NONE        2                                           /* 关闭延迟模拟 */
 
 #endif
\ No newline at end of file
@@ -1,15 +1,23 @@
+#define _GNU_SOURCE                                  /* fallocate */
 #include "stdio.h"
 #include "stdlib.h"
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 #include "string.h"
 #include <linux/fs.h>
 #include "ddriver_ctl.h"
+#include "include/ddriver.h"
 #include "stdio.h"
 #include "errno.h"
 #include <pwd.h>
 #include <time.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stdarg.h>
 
 extern int errno;
 
@@ -22,99 +30,2240 @@ extern int errno;
 *******************************************************************************/   
 #define DEVICE_NAME   "ddriver"
 #define DEVICE_LOG    "ddriver_log"
+#define ENV_BACKEND   "DDRIVER_BACKEND"
+#define ENV_QDEPTH    "DDRIVER_QUEUE_DEPTH"
+#define ENV_DISK_SZ   "DDRIVER_DISK_SZ"
+#define ENV_BLOCK_SZ  "DDRIVER_BLOCK_SZ"
+#define ENV_LATENCY   "DDRIVER_LATENCY"
+#define ENV_TRACE     "DDRIVER_TRACE"
+#define ENV_STRIPE    "DDRIVER_STRIPE"
+#define ENV_STRIPE_UNIT "DDRIVER_STRIPE_UNIT"
+#define ENV_WCACHE    "DDRIVER_WCACHE"
+#define ENV_NCQ       "DDRIVER_NCQ"
+#define SHM_NAME_FMT  "/" DEVICE_NAME "-%d"         /* 按uid区分，位于/dev/shm */
+#define SHM_MAGIC     0x4d485344                     /* "DSHM" */
+#define ENV_MODEL     "DDRIVER_MODEL"
+#define ENV_FLASH_PAGE "DDRIVER_FLASH_PAGE"
+#define ENV_FLASH_BLOCK "DDRIVER_FLASH_BLOCK"
+#define ENV_FLASH_OP  "DDRIVER_FLASH_OP"
 
-#define user_info(fmt, ...)\
-	do {\
-		printf(USER_INFO DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
-        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-	} while(0)\
+#define LOG_PANIC     0
+#define LOG_ALERT     1
+#define LOG_INFO      2
+#ifndef CONFIG_LOG_LEVEL                             /* 编译期日志级别，高于该级别的日志不产生任何代码 */
+#define CONFIG_LOG_LEVEL LOG_INFO
+#endif
 
-#define user_alert(fmt, ...)\
-	do {\
-		printf(USER_ALERT DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
-        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-	} while(0)\
+#if CONFIG_LOG_LEVEL >= LOG_INFO
+#define user_info(fmt, ...)     log_push(LOG_INFO, fmt, ##__VA_ARGS__)
+#else
+#define user_info(fmt, ...)     do { } while (0)
+#endif
+
+#if CONFIG_LOG_LEVEL >= LOG_ALERT
+#define user_alert(fmt, ...)    log_push(LOG_ALERT, fmt, ##__VA_ARGS__)
+#else
+#define user_alert(fmt, ...)    do { } while (0)
+#endif
 
 #define user_panic(fmt, ...)\
     do {\
         printf(USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
+        log_push(LOG_PANIC, fmt, ##__VA_ARGS__);\
     } while (0)\
 
 #define DRIVER_AUTHOR   "Deadpool <deadpoolmine@qq.com>"
 #define DRIVER_DESC     "A Fake disk driver in user space"
 #define DRIVER_VERSION  "0.1.0"
 
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
-#define CONFIG_BLOCK_SZ (512)
-/******************************************************************************
-* SECTION: Macro Functions 
-*******************************************************************************/
-#define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
+#define CONFIG_BLOCK_SZ (512)
+#define MAX_BLOCK_SZ    (64 * 1024)
+#define CONFIG_QDEPTH   (4)
+#define MAX_QDEPTH      (64)
+#define CONFIG_PLUG_DEPTH (128)
+#define CONFIG_STRIPE_UNIT (64 * 1024)
+#define MAX_STRIPE      (16)
+#define CONFIG_FLASH_PAGE (4 * 1024)
+#define CONFIG_FLASH_BLOCK (256 * 1024)
+#define CONFIG_FLASH_OP (7)                          /* 预留空间，逻辑容量的百分比 */
+#define CONFIG_FLASH_READ_US  (50)
+#define CONFIG_FLASH_PROG_US  (200)
+#define CONFIG_FLASH_ERASE_US (2000)
+#define FLASH_GC_RESERVE (1)                         /* 空闲块不多于该值时开始GC */
+#define LOG_RING_SZ     (1024)                       /* 日志环的记录数 */
+#define LOG_MSG_SZ      (232)
+#define LOG_DRAIN_US    (10000)                      /* 后台线程的排空周期 */
+#define SHM_HDR_SZ      (64 * 1024)                  /* 不小于页大小，共享内存头的映射偏移须页对齐 */
+#ifndef IOV_MAX
+#define IOV_MAX         (1024)
+#endif
+/******************************************************************************
+* SECTION: Macro Functions 
+*******************************************************************************/
+#define IGNORE_ARG(arg)         ((void)arg)
+#define IS_ADDR_ALIGN(addr)     (addr % disk.iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     ((addr / disk.iounit_size) * disk.iounit_size)
+#define IS_IN_DEVICE(ofs, size) (ofs >= 0 && ofs + (off_t)size <= disk.layout_size)
+#define STRIPE_WIDTH(disk)      ((off_t)disk.stripe_unit * disk.stripe_nr)
+#define STRIPE_MEMBER(disk, ofs) \
+                                ((int)((ofs / disk.stripe_unit) % disk.stripe_nr))
+#define STRIPE_MEMBER_OFS(disk, ofs) \
+                                ((ofs / STRIPE_WIDTH(disk)) * disk.stripe_unit + ofs % disk.stripe_unit)
+
+#define ATOMIC_ADD(var, n)      (__atomic_add_fetch(&(var), (n), __ATOMIC_RELAXED))
+#define ATOMIC_LOAD(var)        (__atomic_load_n(&(var), __ATOMIC_ACQUIRE))
+#define ATOMIC_XCHG(var, val)   (__atomic_exchange_n(&(var), (val), __ATOMIC_ACQ_REL))
+
+#define INC_READCNT(disk)       (ATOMIC_ADD(disk.cnt->read_cnt, 1))
+#define INC_WRITECNT(disk)      (ATOMIC_ADD(disk.cnt->write_cnt, 1))
+#define INC_SEEKCNT(disk)       (ATOMIC_ADD(disk.cnt->seek_cnt, 1))
+#define ADD_READCNT(disk, n)    (ATOMIC_ADD(disk.cnt->read_cnt, (int)(n)))
+#define ADD_WRITECNT(disk, n)   (ATOMIC_ADD(disk.cnt->write_cnt, (int)(n)))
+
+#define MS_TO_NS(ms)            ((long long)(ms) * 1000000LL)
+#define US_TO_NS(us)            ((long long)(us) * 1000LL)
+#define XFER_NS(disk, size)     ((long long)(size) * 1000000000LL / disk.xfer_rate)
+#define RW_DELAY(disk, rw_ops, size) \
+                                (emulate_delay(MS_TO_NS(disk.rw_ops##_lat) + XFER_NS(disk, size)))
+
+#define MAX_HANDLES             1024
+#define IS_HANDLE_VALID(fd)     (fd >= 0 && fd < MAX_HANDLES && handles[fd].is_open)
+#define GET_HEAD(fd)            (ATOMIC_LOAD(handles[fd].head))
+#define SET_HEAD(fd, ofs)       (__atomic_store_n(&handles[fd].head, (off_t)(ofs), __ATOMIC_RELEASE))
+#define XCHG_HEAD(fd, ofs)      (ATOMIC_XCHG(handles[fd].head, (off_t)(ofs)))
+#define IS_PLUGGED(fd)          (ATOMIC_LOAD(handles[fd].plug.plugged))
+#define TO_SECTOR(ofs)          ((ofs) / disk.iounit_size)
+#define WCACHE_BUCKET(wc, sec)  ((int)((sec) & (wc->nr_buckets - 1)))
+#define SHM_DATA_SZ(size)       (((size) + SHM_HDR_SZ - 1) / SHM_HDR_SZ * SHM_HDR_SZ)
+#define IS_OVERLAP(a_ofs, a_sz, b_ofs, b_sz) \
+                                (a_ofs < b_ofs + (off_t)b_sz && b_ofs < a_ofs + (off_t)a_sz)
+#define IS_CONTAIN(a_ofs, a_sz, b_ofs, b_sz) \
+                                (b_ofs >= a_ofs && b_ofs + (off_t)b_sz <= a_ofs + (off_t)a_sz)
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct ddriver_counters
+{
+    int  read_cnt;
+    int  write_cnt;
+    int  seek_cnt;
+    long long vclock;                                /* 累计的模拟磁盘时间，纳秒 */
+    struct ddriver_stats stats;                      /* 扩展统计，可单独清零 */
+};
+
+struct ddriver_shm_hdr
+{
+    int  magic;
+    int  iounit_size;
+    long long layout_size;
+    int  nr_attached;                                /* 已attach的进程数 */
+    int  unlinked;                                   /* 最后一个进程detach时置1，之后attach须重建 */
+    struct ddriver_counters cnt;                     /* 各进程共享的计数与统计 */
+};
+
+struct ddriver
+{
+    int  ddriver_fd;                                 /* Disk ddriver_fd */
+    struct ddriver_counters *cnt;                    /* 指向local_cnt，shm后端下指向共享内存头 */
+    struct ddriver_shm_hdr *shm;                     /* shm后端的共享内存头，否则为NULL */
+    int  read_lat;
+    int  write_lat;
+    int  seek_lat;
+    int  track_num;
+    long long xfer_rate;                             /* 传输速率，字节/秒 */
+    int  lat_mode;                                   /* DDRIVER_LAT_* */
+    FILE *tracef;                                    /* 块IO轨迹，DDRIVER_TRACE开启 */
+    struct timespec trace_start;
+    int  major_num;
+    off_t layout_size;                               /* 设备大小，打开时确定 */
+    int  iounit_size;                                /* 扇区大小，打开时确定 */
+    int  stripe_nr;                                  /* RAID-0成员数，1为不条带化 */
+    int  stripe_unit;                                /* 条带单位，字节 */
+    struct ddriver_flash *flash;                     /* DDRIVER_MODEL=ssd时的FTL，否则为NULL */
+};
+
+struct plug_req
+{
+    off_t  offset;
+    size_t size;
+    char  *buf;                                      /* 请求数据的副本 */
+};
+
+struct ddriver_plug
+{
+    int              plugged;
+    int              nr;
+    int              cap;
+    struct plug_req *reqs;                           /* 互不重叠的待写请求 */
+    pthread_mutex_t  lock;
+};
+
+struct ddriver_stripe;
+
+struct stripe_member
+{
+    int                    fd;
+    pthread_t              worker;
+    int                    busy;                     /* 本轮有分给该成员的IO */
+    off_t                  offset;                   /* 成员镜像内的起始偏移 */
+    size_t                 size;
+    struct iovec          *iov;                      /* 指向调用者Buf中属于该成员的各段 */
+    int                    iovcnt;
+    int                    iovcap;
+    ssize_t                res;
+    struct ddriver_stripe *stripe;
+};
+
+struct ddriver_stripe
+{
+    int                  nr;
+    int                  op;                         /* 本轮IO方向 */
+    int                  pending;                    /* 本轮尚未完成的成员数 */
+    int                  stop;
+    pthread_mutex_t      io_lock;                    /* 同一时刻只有一个条带IO在分发 */
+    pthread_mutex_t      lock;
+    pthread_cond_t       kick_cond;
+    pthread_cond_t       done_cond;
+    struct stripe_member members[MAX_STRIPE];
+};
+
+struct wcache_ent
+{
+    off_t sector;                                    /* -1表示已失效，槽位待下次刷写后复用 */
+    int   next;                                      /* 哈希链上的下一个槽位 */
+};
+
+struct wcache_ref
+{
+    off_t sector;
+    int   slot;
+};
+
+struct ddriver_wcache
+{
+    int                capacity;                     /* 可缓存的扇区数 */
+    int                nr;                           /* 已用槽位数 */
+    int                nr_buckets;                   /* 2的幂 */
+    int               *buckets;
+    struct wcache_ent *ents;
+    char              *data;                         /* 第i个槽位的数据在data + i * iounit_size */
+    pthread_mutex_t    lock;
+};
+
+struct ddriver_flash
+{
+    int            page_size;
+    int            pages_per_blk;
+    int            nr_lpages;                        /* 逻辑页数 */
+    int            nr_blks;                          /* 物理擦除块数，含预留空间 */
+    int           *l2p;                              /* 逻辑页 -> 物理页，-1为未映射 */
+    int           *p2l;                              /* 物理页 -> 逻辑页，-1为空闲或已失效 */
+    int           *valid;                            /* 每个擦除块内的有效页数 */
+    char          *is_free;                          /* 擦除块是否已擦除待用 */
+    int           *free_blks;                        /* 已擦除块栈 */
+    int            nr_free;
+    int            active;                           /* 正在顺序编程的块 */
+    int            wp;                               /* active块内下一个待编程页 */
+    pthread_mutex_t lock;
+};
+
+struct log_rec
+{
+    unsigned long seq;                               /* 第L圈：2L可写，2L+1可读，读完置为2L+2 */
+    long long     ts_ns;
+    int           level;                             /* LOG_* */
+    char          msg[LOG_MSG_SZ];
+};
+
+struct ddriver_log
+{
+    struct log_rec recs[LOG_RING_SZ];
+    unsigned long  head;                             /* 下一个待写位置，生产者CAS推进 */
+    unsigned long  tail;                             /* 下一个待读位置，仅后台线程访问 */
+    long long      dropped;                          /* 环满时丢弃的记录数 */
+    int            fd;                               /* 日志文件，追加写入 */
+    int            stop;
+    pthread_t      drainer;
+};
+
+struct ddriver_handle
+{
+    int   is_open;
+    off_t head;                                      /* 逻辑磁盘头，不再依赖文件偏移 */
+    off_t last_end;                                  /* 上一次传输的结束位置，判断顺序IO */
+    int   backend;                                   /* DDRIVER_BACKEND_* */
+    char *map;                                       /* MMAP后端下整个镜像的映射 */
+    struct ddriver_aio *aio;                         /* 异步队列，首次提交时创建 */
+    struct ddriver_plug plug;                        /* 电梯调度队列，plug期间暂存写请求 */
+    struct ddriver_stripe *stripe;                   /* RAID-0成员，未条带化时为NULL */
+    struct ddriver_wcache *wcache;                   /* 易失写缓存，关闭时为NULL */
+};
+
+struct ddriver_aio
+{
+    int                fd;
+    int                stop;
+    int                nr_workers;
+    int                ncq;                          /* NCQ：单个磁头，从队首depth个请求中按SPTF选取 */
+    int                depth;
+    int                inflight;                     /* 已提交但未被取走的请求数 */
+    pthread_t          workers[MAX_QDEPTH];
+    long long          lane[MAX_QDEPTH];             /* 各工作线程槽位空闲的虚拟时刻 */
+    int                lane_busy[MAX_QDEPTH];
+    pthread_mutex_t    lock;
+    pthread_cond_t     submit_cond;
+    pthread_cond_t     complete_cond;
+    struct ddriver_io *pending_head;                 /* 待服务请求，FIFO */
+    struct ddriver_io *pending_tail;
+    struct ddriver_io *complete_head;                /* 已完成请求，FIFO */
+    struct ddriver_io *complete_tail;
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+struct ddriver_counters local_cnt;                   /* 本进程私有的计数 */
+
+/* reference: https://en.wikipedia.org/wiki/Hard_disk_drive_performance_characteristics */
+struct ddriver disk = {
+    .cnt         = &local_cnt,
+    .shm         = NULL,
+    .read_lat    = 2,       /* 2ms */       
+    .write_lat   = 1,       /* 1ms */
+    .seek_lat    = 4,       /* 4.17ms per 360 degree */
+    .major_num   = 0,
+    .track_num   = 100,
+    .xfer_rate   = 100 * 1024 * 1024,   /* 100MB/s */
+    .lat_mode    = DDRIVER_LAT_SLEEP,
+    .layout_size = CONFIG_DISK_SZ,
+    .iounit_size = CONFIG_BLOCK_SZ,
+    .stripe_nr   = 1,
+    .stripe_unit = CONFIG_STRIPE_UNIT,
+    .flash       = NULL
+};
+
+struct ddriver_handle handles[MAX_HANDLES];
+__thread long long *vlane = NULL;                    /* 异步请求所在槽位的虚拟时间线，其他情况为NULL */
+
+struct ddriver_log dlog = {
+    .fd          = -1
+};
+
+int nr_open  = 0;                                    /* 打开的handle数，最后一个关闭时关闭日志与轨迹 */
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+/**
+ * @brief 把一条日志放入无锁环，不做系统调用；环满时丢弃并计数，从不阻塞IO路径
+ */
+void log_push(int level, const char *fmt, ...) {
+    struct log_rec *rec;
+    struct timespec now;
+    unsigned long pos = ATOMIC_LOAD(dlog.head);
+    unsigned long lap, seq;
+    va_list ap;
+
+    while (1)
+    {
+        rec = &dlog.recs[pos % LOG_RING_SZ];
+        lap = pos / LOG_RING_SZ * 2;
+        seq = ATOMIC_LOAD(rec->seq);
+        if (seq == lap) {
+            if (__atomic_compare_exchange_n(&dlog.head, &pos, pos + 1, 0, 
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if (seq < lap) {                         /* 上一圈的记录还未写出 */
+            ATOMIC_ADD(dlog.dropped, 1);
+            return;
+        }
+        else {
+            pos = ATOMIC_LOAD(dlog.head);
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec->ts_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    rec->level = level;
+    va_start(ap, fmt);
+    vsnprintf(rec->msg, LOG_MSG_SZ, fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&rec->seq, lap + 1, __ATOMIC_RELEASE);
+}
+/**
+ * @brief 把环中已就绪的记录格式化成行，攒满一批以一次write()追加到日志
+ */
+void log_drain() {
+    static const char *prefix[] = { USER_PANIC, USER_ALERT, USER_INFO };
+    char    batch[16 * 1024];
+    struct log_rec *rec;
+    unsigned long lap;
+    long long dropped;
+    int     len = 0;
+
+    while (1)
+    {
+        rec = &dlog.recs[dlog.tail % LOG_RING_SZ];
+        lap = dlog.tail / LOG_RING_SZ * 2;
+        if (ATOMIC_LOAD(rec->seq) != lap + 1) {
+            break;
+        }
+        if (len > (int)sizeof(batch) - LOG_MSG_SZ - 64) {
+            if (write(dlog.fd, batch, len) < 0) {
+                break;
+            }
+            len = 0;
+        }
+        len += snprintf(batch + len, sizeof(batch) - len, "[%lld.%06lld] %s" DEVICE_NAME " %s\n", 
+                        rec->ts_ns / 1000000000LL, rec->ts_ns % 1000000000LL / 1000, 
+                        prefix[rec->level], rec->msg);
+        __atomic_store_n(&rec->seq, lap + 2, __ATOMIC_RELEASE);
+        dlog.tail++;
+    }
+    dropped = ATOMIC_XCHG(dlog.dropped, 0);
+    if (dropped > 0) {
+        len += snprintf(batch + len, sizeof(batch) - len, 
+                        USER_ALERT DEVICE_NAME " %lld log records dropped\n", dropped);
+    }
+    if (len > 0 && write(dlog.fd, batch, len) < 0) {
+        return;
+    }
+}
+
+void* log_worker(void *arg) {
+    IGNORE_ARG(arg);
+    while (!ATOMIC_LOAD(dlog.stop))
+    {
+        log_drain();
+        usleep(LOG_DRAIN_US);
+    }
+    log_drain();
+    return NULL;
+}
+/**
+ * @brief 以追加方式打开日志并启动后台排空线程，保留之前运行的日志
+ */
+int log_setup(const char *log_path) {
+    if (dlog.fd >= 0) {
+        return 0;
+    }
+    dlog.fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (dlog.fd < 0) {
+        return -EIO;
+    }
+    dlog.stop = 0;
+    if (pthread_create(&dlog.drainer, NULL, log_worker, NULL) != 0) {
+        close(dlog.fd);
+        dlog.fd = -1;
+        return -EIO;
+    }
+    return 0;
+}
+
+void log_teardown() {
+    if (dlog.fd < 0) {
+        return;
+    }
+    __atomic_store_n(&dlog.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(dlog.drainer, NULL);
+    close(dlog.fd);
+    dlog.fd = -1;
+}
+
+int check_valid(size_t size) {
+    if (size != disk.iounit_size){
+        user_alert("io size %ld should align to %d", size, disk.iounit_size);
+        return -EIO;
+    }
+    return 0;
+}
+
+int check_valid_v(size_t size) {
+    if (size == 0 || size % disk.iounit_size != 0){
+        user_alert("io size %ld should be multiple of %d", size, disk.iounit_size);
+        return -EIO;
+    }
+    return 0;
+}
+
+off_t parse_size(const char *str) {
+    char *end;
+    off_t size = strtoll(str, &end, 0);
+    switch (*end)
+    {
+    case 'G': case 'g':
+        size *= 1024;
+        /* fall through */
+    case 'M': case 'm':
+        size *= 1024;
+        /* fall through */
+    case 'K': case 'k':
+        size *= 1024;
+        break;
+    default:
+        break;
+    }
+    return size;
+}
+/**
+ * @brief 确定设备几何：环境变量优先，否则沿用已有镜像大小，否则取默认值；
+ *        镜像不足设备大小时以ftruncate稀疏扩展，不预先分配
+ */
+int geometry_setup(int fd) {
+    char *env_disk_sz  = getenv(ENV_DISK_SZ);
+    char *env_block_sz = getenv(ENV_BLOCK_SZ);
+    struct stat st;
+    int   iounit_size  = CONFIG_BLOCK_SZ;
+    off_t layout_size  = CONFIG_DISK_SZ;
+
+    if (fstat(fd, &st) < 0) {
+        user_panic("can't stat device: %s", strerror(errno));
+        return -EIO;
+    }
+    if (env_block_sz != NULL) {
+        iounit_size = parse_size(env_block_sz);
+    }
+    if (iounit_size < CONFIG_BLOCK_SZ || iounit_size > MAX_BLOCK_SZ 
+        || (iounit_size & (iounit_size - 1)) != 0) {
+        user_panic("invalid block size %d", iounit_size);
+        return -EINVAL;
+    }
+    if (disk.stripe_nr > 1 && disk.stripe_unit % iounit_size != 0) {
+        user_panic("stripe unit %d must be multiple of block size %d", 
+                   disk.stripe_unit, iounit_size);
+        return -EINVAL;
+    }
+    if (env_disk_sz != NULL) {
+        layout_size = parse_size(env_disk_sz);
+    }
+    else if (st.st_size > 0) {
+        layout_size = st.st_size * disk.stripe_nr;   /* fd为0号成员 */
+    }
+    if (disk.stripe_nr > 1) {
+        layout_size = (layout_size / STRIPE_WIDTH(disk)) * STRIPE_WIDTH(disk);
+    }
+    layout_size = (layout_size / iounit_size) * iounit_size;
+    if (layout_size <= 0) {
+        user_panic("invalid disk size %ld", layout_size);
+        return -EINVAL;
+    }
+
+    if (st.st_size < layout_size / disk.stripe_nr 
+        && ftruncate(fd, layout_size / disk.stripe_nr) < 0) {
+        user_panic("low space");
+        return -ENOSPC;
+    }
+    disk.layout_size = layout_size;
+    disk.iounit_size = iounit_size;
+    return 0;
+}
+/**
+ * @brief 读取RAID-0配置：DDRIVER_STRIPE为成员数，DDRIVER_STRIPE_UNIT为条带单位
+ */
+int stripe_config() {
+    char *env_stripe = getenv(ENV_STRIPE);
+    char *env_unit   = getenv(ENV_STRIPE_UNIT);
+
+    disk.stripe_nr   = env_stripe ? atoi(env_stripe) : 1;
+    disk.stripe_unit = env_unit ? parse_size(env_unit) : CONFIG_STRIPE_UNIT;
+    if (disk.stripe_nr < 1 || disk.stripe_nr > MAX_STRIPE) {
+        user_panic("invalid stripe count %d", disk.stripe_nr);
+        return -EINVAL;
+    }
+    if (disk.stripe_unit <= 0) {
+        user_panic("invalid stripe unit %d", disk.stripe_unit);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int device_open(char *path) {
+    if (access(path, F_OK) == 0) {
+        return open(path, O_RDWR);
+    }
+    return open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+}
+
+/**
+ * @brief 按成员拆分的IO，iov过多时分多次提交
+ */
+ssize_t member_io(struct stripe_member *m, int op) {
+    ssize_t res, total = 0;
+    size_t  expect;
+    off_t   offset = m->offset;
+    int     i, j, cnt;
+
+    for (i = 0; i < m->iovcnt; i += cnt) {
+        cnt = m->iovcnt - i > IOV_MAX ? IOV_MAX : m->iovcnt - i;
+        for (j = i, expect = 0; j < i + cnt; j++) {
+            expect += m->iov[j].iov_len;
+        }
+        if (op == DDRIVER_OP_READ) {
+            res = preadv(m->fd, m->iov + i, cnt, offset);
+        }
+        else {
+            res = pwritev(m->fd, m->iov + i, cnt, offset);
+        }
+        if (res != (ssize_t)expect) {
+            return res < 0 ? res : total + res;
+        }
+        total  += res;
+        offset += res;
+    }
+    return total;
+}
+
+void *stripe_worker(void *arg) {
+    struct stripe_member  *m = (struct stripe_member *)arg;
+    struct ddriver_stripe *stripe = m->stripe;
+    ssize_t res;
+
+    pthread_mutex_lock(&stripe->lock);
+    for (;;) {
+        while (!stripe->stop && !m->busy) {
+            pthread_cond_wait(&stripe->kick_cond, &stripe->lock);
+        }
+        if (stripe->stop) {
+            break;
+        }
+        pthread_mutex_unlock(&stripe->lock);
+        res = member_io(m, stripe->op);
+        pthread_mutex_lock(&stripe->lock);
+        m->res  = res;
+        m->busy = 0;
+        if (--stripe->pending == 0) {
+            pthread_cond_signal(&stripe->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    return NULL;
+}
+/**
+ * @brief 将逻辑IO按条带拆到各成员，每个成员的部分在成员镜像上是连续的，
+ *        以一次preadv/pwritev完成；涉及多个成员时由各成员的工作线程并行执行
+ */
+ssize_t stripe_rw(int fd, int op, char *buf, size_t size, off_t offset) {
+    struct ddriver_stripe *stripe = handles[fd].stripe;
+    struct stripe_member  *m, *last = NULL;
+    struct iovec *iov;
+    off_t  pos;
+    size_t len;
+    int    i, nr_busy = 0;
+    ssize_t ret = size;
+
+    pthread_mutex_lock(&stripe->io_lock);
+    for (i = 0; i < stripe->nr; i++) {
+        stripe->members[i].size   = 0;
+        stripe->members[i].iovcnt = 0;
+    }
+    for (pos = offset; pos < offset + (off_t)size; pos += len) {
+        m   = &stripe->members[STRIPE_MEMBER(disk, pos)];
+        len = disk.stripe_unit - pos % disk.stripe_unit;
+        if (len > offset + size - pos) {
+            len = offset + size - pos;
+        }
+        if (m->size == 0) {
+            m->offset = STRIPE_MEMBER_OFS(disk, pos);
+            nr_busy++;
+            last = m;
+        }
+        if (m->iovcnt == m->iovcap) {
+            m->iovcap = m->iovcap ? m->iovcap * 2 : 16;
+            iov = (struct iovec *)realloc(m->iov, m->iovcap * sizeof(struct iovec));
+            if (iov == NULL) {
+                pthread_mutex_unlock(&stripe->io_lock);
+                errno = ENOMEM;
+                return -1;
+            }
+            m->iov = iov;
+        }
+        m->iov[m->iovcnt].iov_base = buf + (pos - offset);
+        m->iov[m->iovcnt].iov_len  = len;
+        m->iovcnt++;
+        m->size += len;
+    }
+
+    if (nr_busy == 1) {                              /* 只落在一个成员上，不必唤醒线程 */
+        last->res = member_io(last, op);
+    }
+    else {
+        pthread_mutex_lock(&stripe->lock);
+        stripe->op      = op;
+        stripe->pending = nr_busy;
+        for (i = 0; i < stripe->nr; i++) {
+            stripe->members[i].busy = stripe->members[i].size != 0;
+        }
+        pthread_cond_broadcast(&stripe->kick_cond);
+        while (stripe->pending > 0) {
+            pthread_cond_wait(&stripe->done_cond, &stripe->lock);
+        }
+        pthread_mutex_unlock(&stripe->lock);
+    }
+
+    for (i = 0; i < stripe->nr; i++) {
+        m = &stripe->members[i];
+        if (m->size != 0 && m->res != (ssize_t)m->size) {
+            errno = EIO;
+            ret = -1;
+        }
+    }
+    pthread_mutex_unlock(&stripe->io_lock);
+    return ret;
+}
+/**
+ * @brief 条带化时各成员中传输量最大者，即并行传输的耗时瓶颈
+ */
+size_t stripe_xfer_size(int fd, off_t offset, size_t size) {
+    size_t bytes[MAX_STRIPE] = {0};
+    size_t len, max = 0;
+    off_t  pos;
+    int    i;
+
+    if (handles[fd].stripe == NULL) {
+        return size;
+    }
+    for (pos = offset; pos < offset + (off_t)size; pos += len) {
+        len = disk.stripe_unit - pos % disk.stripe_unit;
+        if (len > offset + size - pos) {
+            len = offset + size - pos;
+        }
+        bytes[STRIPE_MEMBER(disk, pos)] += len;
+    }
+    for (i = 0; i < disk.stripe_nr; i++) {
+        max = bytes[i] > max ? bytes[i] : max;
+    }
+    return max;
+}
+/**
+ * @brief 打开1~n-1号成员(<path>.<i>)并启动成员线程，0号成员即handle本身
+ */
+int stripe_setup(int fd, char *path) {
+    struct ddriver_stripe *stripe;
+    struct stripe_member  *m;
+    char member_path[160];
+    off_t member_size = disk.layout_size / disk.stripe_nr;
+    struct stat st;
+    int i;
+
+    stripe = (struct ddriver_stripe *)calloc(1, sizeof(struct ddriver_stripe));
+    if (stripe == NULL) {
+        return -ENOMEM;
+    }
+    stripe->nr = disk.stripe_nr;
+    pthread_mutex_init(&stripe->io_lock, NULL);
+    pthread_mutex_init(&stripe->lock, NULL);
+    pthread_cond_init(&stripe->kick_cond, NULL);
+    pthread_cond_init(&stripe->done_cond, NULL);
+    handles[fd].stripe = stripe;
+    for (i = 0; i < stripe->nr; i++) {
+        stripe->members[i].stripe = stripe;
+        stripe->members[i].fd     = -1;
+    }
+
+    for (i = 0; i < stripe->nr; i++) {
+        m = &stripe->members[i];
+        if (i == 0) {
+            m->fd = fd;
+        }
+        else {
+            sprintf(member_path, "%s.%d", path, i);
+            m->fd = device_open(member_path);
+            if (m->fd < 0 || fstat(m->fd, &st) < 0) {
+                user_panic("can't open stripe member %s: %s", member_path, strerror(errno));
+                return -EIO;
+            }
+            if (st.st_size < member_size && ftruncate(m->fd, member_size) < 0) {
+                user_panic("low space");
+                return -ENOSPC;
+            }
+        }
+        if (pthread_create(&m->worker, NULL, stripe_worker, m) != 0) {
+            user_panic("can't start stripe worker: %s", strerror(errno));
+            m->worker = 0;
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
+void stripe_teardown(int fd) {
+    struct ddriver_stripe *stripe = handles[fd].stripe;
+    struct stripe_member  *m;
+    int i;
+
+    if (stripe == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&stripe->lock);
+    stripe->stop = 1;
+    pthread_cond_broadcast(&stripe->kick_cond);
+    pthread_mutex_unlock(&stripe->lock);
+    for (i = 0; i < stripe->nr; i++) {
+        m = &stripe->members[i];
+        if (m->worker) {
+            pthread_join(m->worker, NULL);
+        }
+        if (i > 0 && m->fd >= 0) {
+            close(m->fd);
+        }
+        free(m->iov);
+    }
+    pthread_mutex_destroy(&stripe->io_lock);
+    pthread_mutex_destroy(&stripe->lock);
+    pthread_cond_destroy(&stripe->kick_cond);
+    pthread_cond_destroy(&stripe->done_cond);
+    free(stripe);
+    handles[fd].stripe = NULL;
+}
+
+int stripe_sync(int fd) {
+    struct ddriver_stripe *stripe = handles[fd].stripe;
+    int i, ret = 0;
+
+    if (stripe == NULL) {
+        return fsync(fd);
+    }
+    for (i = 0; i < stripe->nr; i++) {
+        if (fsync(stripe->members[i].fd) < 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+int backend_attach(int fd, int backend) {
+    struct ddriver_handle *h = &handles[fd];
+    char *map;
+
+    if (backend == h->backend) {
+        return 0;
+    }
+    switch (backend)
+    {
+    case DDRIVER_BACKEND_FILE:
+        msync(h->map, disk.layout_size, MS_SYNC);
+        munmap(h->map, disk.layout_size);
+        h->map = NULL;
+        break;
+    case DDRIVER_BACKEND_MMAP:
+        if (h->stripe != NULL) {
+            user_alert("mmap backend is not supported on striped device");
+            return -EINVAL;
+        }
+        map = mmap(NULL, disk.layout_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            user_panic("mmap error: %s", strerror(errno));
+            return -EIO;
+        }
+        h->map = map;
+        break;
+    default:
+        return -EINVAL;
+    }
+    h->backend = backend;
+    return 0;
+}
+
+ssize_t backend_pread(int fd, char *buf, size_t size, off_t offset) {
+    struct ddriver_handle *h = &handles[fd];
+    if (h->backend == DDRIVER_BACKEND_MMAP) {
+        memcpy(buf, h->map + offset, size);
+        return size;
+    }
+    if (h->stripe != NULL) {
+        return stripe_rw(fd, DDRIVER_OP_READ, buf, size, offset);
+    }
+    return pread(fd, buf, size, offset);
+}
+
+ssize_t backend_pwrite(int fd, char *buf, size_t size, off_t offset) {
+    struct ddriver_handle *h = &handles[fd];
+    if (h->backend == DDRIVER_BACKEND_MMAP) {
+        memcpy(h->map + offset, buf, size);
+        return size;
+    }
+    if (h->stripe != NULL) {
+        return stripe_rw(fd, DDRIVER_OP_WRITE, buf, size, offset);
+    }
+    return pwrite(fd, buf, size, offset);
+}
+
+/**
+ * @brief 在后备镜像上打洞；文件系统不支持打洞时退化为写0
+ */
+int punch_hole(int fd, off_t offset, off_t len) {
+    static char zero[MAX_BLOCK_SZ];
+    size_t chunk;
+
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0) {
+        return 0;
+    }
+    if (errno != EOPNOTSUPP) {
+        user_panic("discard error: %s", strerror(errno));
+        return -EIO;
+    }
+    for (; len > 0; offset += chunk, len -= chunk) {
+        chunk = len > MAX_BLOCK_SZ ? MAX_BLOCK_SZ : len;
+        if (pwrite(fd, zero, chunk, offset) != (ssize_t)chunk) {
+            return -EIO;
+        }
+    }
+    return 0;
+}
+/**
+ * @brief 丢弃一段区域。MMAP后端与文件共享页缓存，打洞后映射读出同样为0；
+ *        条带化时每个成员上的部分是连续的，各打一次洞
+ */
+int backend_discard(int fd, off_t offset, off_t len) {
+    struct ddriver_stripe *stripe = handles[fd].stripe;
+    off_t  member_ofs[MAX_STRIPE];
+    off_t  member_len[MAX_STRIPE] = {0};
+    off_t  pos, chunk;
+    int    i, ret = 0;
+
+    if (stripe == NULL) {
+        return punch_hole(fd, offset, len);
+    }
+    for (pos = offset; pos < offset + len; pos += chunk) {
+        i     = STRIPE_MEMBER(disk, pos);
+        chunk = disk.stripe_unit - pos % disk.stripe_unit;
+        if (chunk > offset + len - pos) {
+            chunk = offset + len - pos;
+        }
+        if (member_len[i] == 0) {
+            member_ofs[i] = STRIPE_MEMBER_OFS(disk, pos);
+        }
+        member_len[i] += chunk;
+    }
+    for (i = 0; i < stripe->nr; i++) {
+        if (member_len[i] != 0 && punch_hole(stripe->members[i].fd, member_ofs[i], member_len[i]) < 0) {
+            ret = -EIO;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief 创建共享内存段：按镜像文件确定几何，载入镜像内容(跳过全0块)，在段尾写入头
+ */
+int shm_load(int fd, char *path) {
+    static char buf[MAX_BLOCK_SZ];
+    static char zero[MAX_BLOCK_SZ];
+    struct ddriver_shm_hdr hdr;
+    off_t   pos;
+    ssize_t res;
+    int     ifd, ret;
+
+    ifd = device_open(path);
+    if (ifd < 0) {
+        user_panic("can't open image %s: %s", path, strerror(errno));
+        return -EIO;
+    }
+    ret = geometry_setup(ifd);
+    if (ret == 0 && ftruncate(fd, SHM_DATA_SZ(disk.layout_size) + SHM_HDR_SZ) < 0) {
+        user_panic("low shared memory");
+        ret = -ENOSPC;
+    }
+    for (pos = 0; ret == 0 && pos < disk.layout_size; pos += res) {
+        res = pread(ifd, buf, disk.layout_size - pos > MAX_BLOCK_SZ ? MAX_BLOCK_SZ 
+                                                                     : disk.layout_size - pos, pos);
+        if (res <= 0) {
+            ret = -EIO;
+        }
+        else if (memcmp(buf, zero, res) != 0 && pwrite(fd, buf, res, pos) != res) {
+            ret = -EIO;
+        }
+    }
+    close(ifd);
+    if (ret < 0) {
+        return ret;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic       = SHM_MAGIC;
+    hdr.iounit_size = disk.iounit_size;
+    hdr.layout_size = disk.layout_size;
+    if (pwrite(fd, &hdr, sizeof(hdr), SHM_DATA_SZ(disk.layout_size)) != sizeof(hdr)) {
+        return -EIO;
+    }
+    return 0;
+}
+/**
+ * @brief 把共享内存段中的数据写回镜像文件，全0块在镜像上打洞
+ */
+int shm_writeback(int fd) {
+    static char buf[MAX_BLOCK_SZ];
+    static char zero[MAX_BLOCK_SZ];
+    char    path[128];
+    off_t   pos;
+    ssize_t res;
+    int     ifd, ret = 0;
+
+    sprintf(path, "%s/" DEVICE_NAME, getpwuid(getuid())->pw_dir);
+    ifd = device_open(path);
+    if (ifd < 0) {
+        user_panic("can't open image %s: %s", path, strerror(errno));
+        return -EIO;
+    }
+    for (pos = 0; ret == 0 && pos < disk.layout_size; pos += res) {
+        res = pread(fd, buf, disk.layout_size - pos > MAX_BLOCK_SZ ? MAX_BLOCK_SZ 
+                                                                    : disk.layout_size - pos, pos);
+        if (res <= 0) {
+            ret = -EIO;
+        }
+        else if (memcmp(buf, zero, res) == 0) {
+            ret = punch_hole(ifd, pos, res);
+        }
+        else if (pwrite(ifd, buf, res, pos) != res) {
+            ret = -EIO;
+        }
+    }
+    if (ret == 0 && fsync(ifd) < 0) {
+        ret = -EIO;
+    }
+    close(ifd);
+    return ret;
+}
+/**
+ * @brief 以POSIX共享内存段作为设备，多个进程(FUSE守护进程、fsck、基准程序)可同时attach，
+ *        共享数据与计数。数据位于段首，段尾为ddriver_shm_hdr；第一个attach的进程从镜像
+ *        文件载入，最后一个detach的进程写回镜像并删除该段
+ * 
+ * @return int 共享内存段的fd，即handle
+ */
+int shm_attach(char *path) {
+    struct ddriver_shm_hdr *hdr = NULL;
+    struct stat st;
+    char   name[64];
+    int    fd, ret = 0;
+
+    sprintf(name, SHM_NAME_FMT, getuid());
+    while (1) {
+        fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+        if (fd < 0) {
+            user_panic("can't open shared memory %s: %s", name, strerror(errno));
+            return -EIO;
+        }
+        if (disk.shm != NULL) {                      /* 本进程已attach，只需再开一个handle */
+            return fd;
+        }
+        flock(fd, LOCK_EX);                          /* 同时首次attach的进程中只有一个载入镜像 */
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            ret = shm_load(fd, path);
+        }
+        if (ret == 0 && fstat(fd, &st) < 0) {
+            ret = -EIO;
+        }
+        if (ret == 0) {
+            hdr = mmap(NULL, SHM_HDR_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, 
+                       fd, st.st_size - SHM_HDR_SZ);
+            if (hdr == MAP_FAILED || hdr->magic != SHM_MAGIC) {
+                user_panic("bad shared memory %s", name);
+                ret = -EIO;
+            }
+        }
+        if (ret < 0) {
+            if (hdr != NULL && hdr != MAP_FAILED) {
+                munmap(hdr, SHM_HDR_SZ);
+            }
+            flock(fd, LOCK_UN);
+            close(fd);
+            return ret;
+        }
+        if (!hdr->unlinked) {
+            break;
+        }
+        munmap(hdr, SHM_HDR_SZ);                     /* 打开的是刚被删除的段，重新创建 */
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+
+    disk.layout_size = hdr->layout_size;
+    disk.iounit_size = hdr->iounit_size;
+    disk.shm = hdr;
+    disk.cnt = &hdr->cnt;
+    hdr->nr_attached++;
+    flock(fd, LOCK_UN);
+    return fd;
+}
+
+void shm_detach(int fd) {
+    struct ddriver_shm_hdr *hdr = disk.shm;
+    char name[64];
+
+    if (hdr == NULL) {
+        return;
+    }
+    sprintf(name, SHM_NAME_FMT, getuid());
+    flock(fd, LOCK_EX);
+    if (--hdr->nr_attached == 0) {
+        if (shm_writeback(fd) < 0) {
+            user_alert("write back failed, keep shared memory %s", name);
+        }
+        else {
+            hdr->unlinked = 1;
+            shm_unlink(name);
+        }
+    }
+    flock(fd, LOCK_UN);
+    memcpy(&local_cnt, &hdr->cnt, sizeof(struct ddriver_counters));
+    disk.cnt = &local_cnt;
+    disk.shm = NULL;
+    munmap(hdr, SHM_HDR_SZ);
+}
+
+int latency_setup() {
+    char *lat_mode = getenv(ENV_LATENCY);
+    if (lat_mode == NULL || strcmp(lat_mode, "sleep") == 0) {
+        disk.lat_mode = DDRIVER_LAT_SLEEP;
+    }
+    else if (strcmp(lat_mode, "virtual") == 0) {
+        disk.lat_mode = DDRIVER_LAT_VIRTUAL;
+    }
+    else if (strcmp(lat_mode, "none") == 0) {
+        disk.lat_mode = DDRIVER_LAT_NONE;
+    }
+    else {
+        user_panic("unknown latency mode %s", lat_mode);
+        return -EINVAL;
+    }
+    return 0;
+}
+/**
+ * @brief 把虚拟时钟推进到不早于t
+ */
+void vclock_advance_to(long long t) {
+    long long cur = ATOMIC_LOAD(disk.cnt->vclock);
+
+    while (cur < t && !__atomic_compare_exchange_n(&disk.cnt->vclock, &cur, t, 0, 
+                                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+/**
+ * @brief 计入一段模拟的磁盘时间，SLEEP模式下真实睡眠，VIRTUAL模式下只推进虚拟时钟。
+ *        异步请求计入所在槽位的时间线，虚拟时钟取各时间线的最远点，
+ *        因此不同槽位上的请求在虚拟时钟下同样相互重叠
+ */
+long long emulate_delay(long long ns) {
+    if (disk.lat_mode == DDRIVER_LAT_NONE || ns <= 0) {
+        return 0;
+    }
+    if (vlane != NULL) {
+        *vlane += ns;
+        vclock_advance_to(*vlane);
+    }
+    else {
+        ATOMIC_ADD(disk.cnt->vclock, ns);
+    }
+    if (disk.lat_mode == DDRIVER_LAT_SLEEP) {
+        usleep(ns / 1000);
+    }
+    return ns;
+}
+
+/**
+ * @brief 磁头从start移动到end的定位时间，不计入时钟；NCQ据此选取下一个请求
+ */
+long long position_ns(off_t start, off_t end) {
+    off_t bytes_per_track = disk.layout_size / disk.track_num;
+    int lat_per_track = disk.seek_lat;
+    off_t distance = llabs(end - start) % bytes_per_track; 
+
+    if (distance == 0 || disk.flash != NULL) {       /* 闪存没有寻道与旋转延迟 */
+        return 0;
+    }
+    return distance * MS_TO_NS(lat_per_track) / bytes_per_track;
+}
+
+long long emulate_rotate(int fd, off_t start, off_t end) {
+    ATOMIC_ADD(disk.cnt->stats.seek_distance, llabs(end - start));
+    return emulate_delay(position_ns(start, end));
+}
+
+/**
+ * @brief 回到出厂状态：所有逻辑页未映射，所有块已擦除
+ */
+void flash_reset(struct ddriver_flash *fl) {
+    int i;
+
+    pthread_mutex_lock(&fl->lock);
+    memset(fl->l2p, -1, sizeof(int) * fl->nr_lpages);
+    memset(fl->p2l, -1, sizeof(int) * fl->nr_blks * fl->pages_per_blk);
+    memset(fl->valid, 0, sizeof(int) * fl->nr_blks);
+    memset(fl->is_free, 1, fl->nr_blks);
+    for (i = 0; i < fl->nr_blks; i++) {
+        fl->free_blks[i] = fl->nr_blks - 1 - i;
+    }
+    fl->nr_free = fl->nr_blks - 1;
+    fl->active  = fl->free_blks[fl->nr_free];
+    fl->is_free[fl->active] = 0;
+    fl->wp      = 0;
+    pthread_mutex_unlock(&fl->lock);
+}
+
+void flash_teardown() {
+    struct ddriver_flash *fl = disk.flash;
+
+    if (fl == NULL) {
+        return;
+    }
+    free(fl->l2p);
+    free(fl->p2l);
+    free(fl->valid);
+    free(fl->is_free);
+    free(fl->free_blks);
+    pthread_mutex_destroy(&fl->lock);
+    free(fl);
+    disk.flash = NULL;
+}
+/**
+ * @brief 读取设备模型：DDRIVER_MODEL为hdd(默认)或ssd，ssd时按页大小、擦除块大小与
+ *        预留空间建立页映射FTL，所有handle共享
+ */
+int flash_setup() {
+    char *model       = getenv(ENV_MODEL);
+    char *env_page    = getenv(ENV_FLASH_PAGE);
+    char *env_block   = getenv(ENV_FLASH_BLOCK);
+    char *env_op      = getenv(ENV_FLASH_OP);
+    struct ddriver_flash *fl;
+    int   page_size   = CONFIG_FLASH_PAGE;
+    int   block_size  = CONFIG_FLASH_BLOCK;
+    int   op          = env_op ? atoi(env_op) : CONFIG_FLASH_OP;
+    long long nr_pages;
+
+    if (model == NULL || strcmp(model, "hdd") == 0 || disk.flash != NULL) {
+        return 0;
+    }
+    if (strcmp(model, "ssd") != 0) {
+        user_panic("unknown device model %s", model);
+        return -EINVAL;
+    }
+    if (env_page != NULL) {
+        page_size = parse_size(env_page);
+    }
+    else if (page_size < disk.iounit_size) {
+        page_size = disk.iounit_size;
+    }
+    if (env_block != NULL) {
+        block_size = parse_size(env_block);
+    }
+    if (page_size <= 0 || page_size % disk.iounit_size != 0 
+        || block_size <= 0 || block_size % page_size != 0 || op < 0) {
+        user_panic("invalid flash geometry: page %d, block %d, op %d%%", 
+                   page_size, block_size, op);
+        return -EINVAL;
+    }
+
+    fl = (struct ddriver_flash *)calloc(1, sizeof(struct ddriver_flash));
+    if (fl == NULL) {
+        return -ENOMEM;
+    }
+    fl->page_size     = page_size;
+    fl->pages_per_blk = block_size / page_size;
+    fl->nr_lpages     = (disk.layout_size + page_size - 1) / page_size;
+    nr_pages          = (long long)fl->nr_lpages * (100 + op) / 100;
+    fl->nr_blks       = (nr_pages + fl->pages_per_blk - 1) / fl->pages_per_blk;
+    if (fl->nr_blks < fl->nr_lpages / fl->pages_per_blk + 3) {
+        fl->nr_blks = fl->nr_lpages / fl->pages_per_blk + 3;  /* GC总能找到含无效页的块 */
+    }
+    fl->l2p       = (int *)malloc(sizeof(int) * fl->nr_lpages);
+    fl->p2l       = (int *)malloc(sizeof(int) * fl->nr_blks * fl->pages_per_blk);
+    fl->valid     = (int *)malloc(sizeof(int) * fl->nr_blks);
+    fl->is_free   = (char *)malloc(fl->nr_blks);
+    fl->free_blks = (int *)malloc(sizeof(int) * fl->nr_blks);
+    pthread_mutex_init(&fl->lock, NULL);
+    disk.flash = fl;
+    if (fl->l2p == NULL || fl->p2l == NULL || fl->valid == NULL 
+        || fl->is_free == NULL || fl->free_blks == NULL) {
+        flash_teardown();
+        return -ENOMEM;
+    }
+    flash_reset(fl);
+    return 0;
+}
+
+long long flash_gc(struct ddriver_flash *fl);
+/**
+ * @brief 把逻辑页编程到active块的下一页，旧物理页失效；返回耗时，含触发的GC
+ * 
+ * @param gc 由GC搬移调用时为1，此时不再递归触发GC
+ */
+long long flash_program(struct ddriver_flash *fl, int lpn, int gc) {
+    long long ns = 0;
+    int old = fl->l2p[lpn];
+    int ppn;
+
+    if (!gc) {
+        while (fl->nr_free <= FLASH_GC_RESERVE) {
+            ns += flash_gc(fl);
+        }
+    }
+    if (fl->wp == fl->pages_per_blk) {
+        fl->active = fl->free_blks[--fl->nr_free];
+        fl->is_free[fl->active] = 0;
+        fl->wp     = 0;
+    }
+    ppn = fl->active * fl->pages_per_blk + fl->wp++;
+    if (old >= 0) {
+        fl->p2l[old] = -1;
+        fl->valid[old / fl->pages_per_blk]--;
+    }
+    fl->l2p[lpn] = ppn;
+    fl->p2l[ppn] = lpn;
+    fl->valid[fl->active]++;
+    ATOMIC_ADD(disk.cnt->stats.flash_prog_bytes, (long long)fl->page_size);
+    return ns + US_TO_NS(CONFIG_FLASH_PROG_US);
+}
+/**
+ * @brief 贪心GC：回收有效页最少的已写满块，搬移其有效页后擦除；返回停顿时间
+ */
+long long flash_gc(struct ddriver_flash *fl) {
+    long long ns = 0;
+    int victim = -1;
+    int b, i, ppn;
+
+    for (b = 0; b < fl->nr_blks; b++) {
+        if (fl->is_free[b] || b == fl->active) {
+            continue;
+        }
+        if (victim < 0 || fl->valid[b] < fl->valid[victim]) {
+            victim = b;
+        }
+    }
+    if (victim < 0) {
+        return 0;
+    }
+
+    for (i = 0; i < fl->pages_per_blk && fl->valid[victim] > 0; i++) {
+        ppn = victim * fl->pages_per_blk + i;
+        if (fl->p2l[ppn] < 0) {
+            continue;
+        }
+        ns += US_TO_NS(CONFIG_FLASH_READ_US);
+        ns += flash_program(fl, fl->p2l[ppn], 1);
+        ATOMIC_ADD(disk.cnt->stats.flash_read_pages, 1);
+        ATOMIC_ADD(disk.cnt->stats.flash_gc_pages, 1);
+    }
+    fl->is_free[victim] = 1;
+    fl->free_blks[fl->nr_free++] = victim;
+    ns += US_TO_NS(CONFIG_FLASH_ERASE_US);
+    ATOMIC_ADD(disk.cnt->stats.flash_erases, 1);
+    ATOMIC_ADD(disk.cnt->stats.flash_gc_ns, ns);
+    return ns;
+}
+/**
+ * @brief 闪存写：未整页覆盖且已映射的页先读出(盘内读改写)，每页编程到新位置
+ */
+long long flash_write(off_t offset, size_t size) {
+    struct ddriver_flash *fl = disk.flash;
+    long long ns = 0;
+    off_t end = offset + (off_t)size;
+    off_t page_ofs, page_end;
+    int   lpn;
+
+    pthread_mutex_lock(&fl->lock);
+    for (lpn = offset / fl->page_size; (off_t)lpn * fl->page_size < end; lpn++) {
+        page_ofs = (off_t)lpn * fl->page_size;
+        page_end = page_ofs + fl->page_size;
+        if (page_end > disk.layout_size) {
+            page_end = disk.layout_size;
+        }
+        if ((page_ofs < offset || page_end > end) && fl->l2p[lpn] >= 0) {
+            ns += US_TO_NS(CONFIG_FLASH_READ_US);
+            ATOMIC_ADD(disk.cnt->stats.flash_read_pages, 1);
+        }
+        ns += flash_program(fl, lpn, 0);
+    }
+    pthread_mutex_unlock(&fl->lock);
+    return emulate_delay(ns);
+}
+/**
+ * @brief 闪存读：每涉及一页计一次页读，没有寻道
+ */
+long long flash_read(off_t offset, size_t size) {
+    struct ddriver_flash *fl = disk.flash;
+    long long nr = (offset + (off_t)size + fl->page_size - 1) / fl->page_size 
+                   - offset / fl->page_size;
+
+    ATOMIC_ADD(disk.cnt->stats.flash_read_pages, nr);
+    return emulate_delay(nr * US_TO_NS(CONFIG_FLASH_READ_US));
+}
+/**
+ * @brief TRIM：整页落在区间内的逻辑页解除映射，之后GC无需搬移
+ */
+void flash_trim(off_t offset, off_t len) {
+    struct ddriver_flash *fl = disk.flash;
+    int lpn, ppn;
+
+    if (fl == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&fl->lock);
+    for (lpn = (offset + fl->page_size - 1) / fl->page_size; 
+         (off_t)(lpn + 1) * fl->page_size <= offset + len; lpn++) {
+        ppn = fl->l2p[lpn];
+        if (ppn >= 0) {
+            fl->p2l[ppn] = -1;
+            fl->valid[ppn / fl->pages_per_blk]--;
+            fl->l2p[lpn] = -1;
+        }
+    }
+    pthread_mutex_unlock(&fl->lock);
+}
+
+int lat_bucket(long long ns) {
+    long long us = ns / 1000;
+    int bucket = 0;
+    while (us > 1 && bucket < DDRIVER_HIST_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+/**
+ * @brief 记录一次完成的传输：字节数、顺序/随机、模拟耗时及其log2直方图
+ */
+void stats_account(int fd, int op, off_t offset, size_t size, long long lat_ns) {
+    struct ddriver_stats *stats = &disk.cnt->stats;
+
+    if (ATOMIC_XCHG(handles[fd].last_end, offset + (off_t)size) == offset) {
+        ATOMIC_ADD(stats->seq_ops, 1);
+    }
+    else {
+        ATOMIC_ADD(stats->rand_ops, 1);
+    }
+
+    if (op == DDRIVER_OP_WRITE) {
+        ATOMIC_ADD(stats->write_ops, 1);
+        ATOMIC_ADD(stats->write_bytes, (long long)size);
+        ATOMIC_ADD(stats->write_ns, lat_ns);
+        ATOMIC_ADD(stats->write_hist[lat_bucket(lat_ns)], 1);
+    }
+    else {
+        ATOMIC_ADD(stats->read_ops, 1);
+        ATOMIC_ADD(stats->read_bytes, (long long)size);
+        ATOMIC_ADD(stats->read_ns, lat_ns);
+        ATOMIC_ADD(stats->read_hist[lat_bucket(lat_ns)], 1);
+    }
+}
+
+int trace_setup() {
+    char *trace_path = getenv(ENV_TRACE);
+    struct ddriver_trace_hdr hdr;
+
+    if (trace_path == NULL || disk.tracef != NULL) {
+        return 0;
+    }
+    disk.tracef = fopen(trace_path, "w");
+    if (disk.tracef == NULL) {
+        user_panic("can't open trace %s: %s", trace_path, strerror(errno));
+        return -EIO;
+    }
+    hdr.magic       = DDRIVER_TRACE_MAGIC;
+    hdr.version     = DDRIVER_TRACE_VERSION;
+    hdr.iounit_size = disk.iounit_size;
+    hdr.layout_size = disk.layout_size;
+    fwrite(&hdr, sizeof(hdr), 1, disk.tracef);
+    clock_gettime(CLOCK_MONOTONIC, &disk.trace_start);
+    return 0;
+}
+
+void trace_record(int op, off_t offset, size_t size) {
+    struct ddriver_trace_rec rec;
+    struct timespec now;
+
+    if (disk.tracef == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rec.ts_ns  = (now.tv_sec - disk.trace_start.tv_sec) * 1000000000LL 
+                 + (now.tv_nsec - disk.trace_start.tv_nsec);
+    rec.offset = offset;
+    rec.size   = size;
+    rec.op     = op;
+    fwrite(&rec, sizeof(rec), 1, disk.tracef);
+}
+
+void trace_teardown() {
+    if (disk.tracef != NULL) {
+        fclose(disk.tracef);
+        disk.tracef = NULL;
+    }
+}
+
+void stats_reset() {
+    disk.cnt->read_cnt = 0;
+    disk.cnt->write_cnt = 0;
+    disk.cnt->seek_cnt = 0;
+    disk.cnt->vclock = 0;
+    memset(&disk.cnt->stats, 0, sizeof(struct ddriver_stats));
+}
+void aio_enqueue(struct ddriver_io **head, struct ddriver_io **tail, 
+                 struct ddriver_io *io) {
+    io->next = NULL;
+    if (*tail == NULL) {
+        *head = io;
+    }
+    else {
+        (*tail)->next = io;
+    }
+    *tail = io;
+}
+
+struct ddriver_io* aio_dequeue(struct ddriver_io **head, struct ddriver_io **tail) {
+    struct ddriver_io *io = *head;
+    if (io != NULL) {
+        *head = io->next;
+        if (*head == NULL) {
+            *tail = NULL;
+        }
+        io->next = NULL;
+    }
+    return io;
+}
+
+/**
+ * @brief 为请求占用最早空闲的槽位，返回槽位号；槽位数与工作线程数相同，
+ *        因此总有空闲槽位，模拟结果与线程的真实调度无关
+ */
+int aio_lane_get(struct ddriver_aio *aio, struct ddriver_io *io) {
+    long long now = ATOMIC_LOAD(disk.cnt->vclock);
+    int i, best = -1;
+
+    for (i = 0; i < aio->nr_workers; i++) {
+        if (!aio->lane_busy[i] && aio->lane[i] > now) {  /* 时钟已被STATS_RESET清零 */
+            aio->lane[i] = 0;
+        }
+        if (!aio->lane_busy[i] && (best < 0 || aio->lane[i] < aio->lane[best])) {
+            best = i;
+        }
+    }
+    aio->lane_busy[best] = 1;
+    if (aio->lane[best] < io->submit_ns) {           /* 请求提交前槽位已空闲 */
+        aio->lane[best] = io->submit_ns;
+    }
+    return best;
+}
+
+/**
+ * @brief 取出下一个待服务请求：默认FIFO；NCQ时在队首depth个请求中选定位时间最短的(SPTF)，
+ *        相同时取先提交者
+ */
+struct ddriver_io* aio_pick(struct ddriver_aio *aio) {
+    struct ddriver_io *io, *prev, *best = NULL, *best_prev = NULL;
+    long long cost, best_cost = 0;
+    off_t head;
+    int i;
+
+    if (!aio->ncq) {
+        return aio_dequeue(&aio->pending_head, &aio->pending_tail);
+    }
+    head = GET_HEAD(aio->fd);
+    for (i = 0, prev = NULL, io = aio->pending_head; io != NULL && i < aio->depth; 
+         i++, prev = io, io = io->next) {
+        cost = position_ns(head, io->offset);
+        if (best == NULL || cost < best_cost) {
+            best      = io;
+            best_prev = prev;
+            best_cost = cost;
+        }
+    }
+    if (best == NULL || best_prev == NULL) {
+        return aio_dequeue(&aio->pending_head, &aio->pending_tail);
+    }
+    best_prev->next = best->next;
+    if (aio->pending_tail == best) {
+        aio->pending_tail = best_prev;
+    }
+    best->next = NULL;
+    return best;
+}
+
+void* aio_worker(void *arg) {
+    struct ddriver_aio *aio = (struct ddriver_aio *)arg;
+    struct ddriver_io  *io;
+    long long           lane;
+    int                 slot = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&aio->lock);
+        while (aio->pending_head == NULL && !aio->stop) {
+            pthread_cond_wait(&aio->submit_cond, &aio->lock);
+        }
+        io = aio_pick(aio);
+        if (io != NULL) {
+            slot = aio_lane_get(aio, io);
+            lane = aio->lane[slot];
+        }
+        pthread_mutex_unlock(&aio->lock);
+        if (io == NULL) {                             /* stop且队列已空 */
+            break;
+        }
+
+        vlane = &lane;
+        if (io->op == DDRIVER_OP_WRITE) {
+            io->res = ddriver_pwrite2(aio->fd, io->buf, io->size, io->offset, io->flags);
+        }
+        else {
+            io->res = ddriver_pread(aio->fd, io->buf, io->size, io->offset);
+        }
+        vlane = NULL;
+        io->complete_ns = lane;
+
+        pthread_mutex_lock(&aio->lock);
+        aio->lane[slot]      = lane;
+        aio->lane_busy[slot] = 0;
+        aio_enqueue(&aio->complete_head, &aio->complete_tail, io);
+        pthread_cond_broadcast(&aio->complete_cond);
+        pthread_mutex_unlock(&aio->lock);
+    }
+    return NULL;
+}
+
+struct ddriver_aio* aio_setup(int fd) {
+    struct ddriver_aio *aio = (struct ddriver_aio *)calloc(1, sizeof(struct ddriver_aio));
+    char *qdepth = getenv(ENV_QDEPTH);
+    char *ncq    = getenv(ENV_NCQ);
+    int i;
+
+    if (aio == NULL) {
+        user_alert("can't allocate aio queue");
+        return NULL;
+    }
+    aio->fd = fd;
+    aio->nr_workers = qdepth ? atoi(qdepth) : CONFIG_QDEPTH;
+    if (aio->nr_workers < 1 || aio->nr_workers > MAX_QDEPTH) {
+        aio->nr_workers = CONFIG_QDEPTH;
+    }
+    aio->ncq   = ncq != NULL && atoi(ncq) != 0;
+    aio->depth = aio->nr_workers;
+    if (aio->ncq) {                                   /* 只有一个磁头，请求依次服务 */
+        aio->nr_workers = 1;
+    }
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->submit_cond, NULL);
+    pthread_cond_init(&aio->complete_cond, NULL);
+    for (i = 0; i < aio->nr_workers; i++) {
+        if (pthread_create(&aio->workers[i], NULL, aio_worker, aio) != 0) {
+            user_panic("can't start aio worker: %s", strerror(errno));
+            break;
+        }
+    }
+    aio->nr_workers = i;
+    return aio;
+}
+
+void aio_teardown(struct ddriver_aio *aio) {
+    int i;
+
+    pthread_mutex_lock(&aio->lock);
+    aio->stop = 1;
+    pthread_cond_broadcast(&aio->submit_cond);
+    pthread_mutex_unlock(&aio->lock);
+    for (i = 0; i < aio->nr_workers; i++) {
+        pthread_join(aio->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&aio->lock);
+    pthread_cond_destroy(&aio->submit_cond);
+    pthread_cond_destroy(&aio->complete_cond);
+    free(aio);
+}
+/**
+ * @brief 写入介质：模拟寻道与传输延迟、访问后端、记账
+ */
+int media_write(int fd, char *buf, size_t size, off_t offset) {
+    long long lat = 0;
+    off_t     head;
+
+    head = XCHG_HEAD(fd, offset + size);              /* 并发请求各自从前一个请求的结尾寻道 */
+    if (offset != head) {
+        INC_SEEKCNT(disk);
+        lat += emulate_rotate(fd, head, offset);
+    }
+    if (disk.flash != NULL) {
+        lat += flash_write(offset, size);
+    }
+    else {
+        lat += RW_DELAY(disk, write, stripe_xfer_size(fd, offset, size));
+    }
+    if (backend_pwrite(fd, buf, size, offset) != (ssize_t)size) {
+        user_panic("write error: %s", strerror(errno));
+        return -EIO;
+    }
+
+    ADD_WRITECNT(disk, size / disk.iounit_size);
+    stats_account(fd, DDRIVER_OP_WRITE, offset, size, lat);
+    trace_record(DDRIVER_OP_WRITE, offset, size);
+    return size;
+}
+/**
+ * @brief 从介质读出：模拟寻道与传输延迟、访问后端、记账
+ */
+int media_read(int fd, char *buf, size_t size, off_t offset) {
+    long long lat = 0;
+    off_t     head;
+
+    head = XCHG_HEAD(fd, offset + size);              /* 并发请求各自从前一个请求的结尾寻道 */
+    if (offset != head) {
+        INC_SEEKCNT(disk);
+        lat += emulate_rotate(fd, head, offset);
+    }
+    if (disk.flash != NULL) {
+        lat += flash_read(offset, size);
+    }
+    else {
+        lat += RW_DELAY(disk, read, stripe_xfer_size(fd, offset, size));
+    }
+    if (backend_pread(fd, buf, size, offset) != (ssize_t)size) {
+        user_panic("read error: %s", strerror(errno));
+        return -EIO;
+    }
+
+    ADD_READCNT(disk, size / disk.iounit_size);
+    stats_account(fd, DDRIVER_OP_READ, offset, size, lat);
+    trace_record(DDRIVER_OP_READ, offset, size);
+    return size;
+}
+
+int wcache_ref_cmp(const void *a, const void *b) {
+    off_t lhs = ((const struct wcache_ref *)a)->sector;
+    off_t rhs = ((const struct wcache_ref *)b)->sector;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+struct ddriver_wcache* wcache_setup(long long bytes) {
+    struct ddriver_wcache *wc;
+    int i;
+
+    wc = (struct ddriver_wcache *)calloc(1, sizeof(struct ddriver_wcache));
+    if (wc == NULL) {
+        return NULL;
+    }
+    wc->capacity   = bytes / disk.iounit_size;
+    wc->nr_buckets = 1;
+    while (wc->nr_buckets < wc->capacity * 2) {
+        wc->nr_buckets <<= 1;
+    }
+    wc->buckets = (int *)malloc(wc->nr_buckets * sizeof(int));
+    wc->ents    = (struct wcache_ent *)malloc(wc->capacity * sizeof(struct wcache_ent));
+    wc->data    = (char *)malloc((size_t)wc->capacity * disk.iounit_size);
+    if (wc->capacity <= 0 || wc->buckets == NULL || wc->ents == NULL || wc->data == NULL) {
+        user_panic("can't setup write cache of %lld bytes", bytes);
+        free(wc->buckets);
+        free(wc->ents);
+        free(wc->data);
+        free(wc);
+        return NULL;
+    }
+    for (i = 0; i < wc->nr_buckets; i++) {
+        wc->buckets[i] = -1;
+    }
+    pthread_mutex_init(&wc->lock, NULL);
+    return wc;
+}
+
+void wcache_teardown(struct ddriver_wcache *wc) {
+    pthread_mutex_destroy(&wc->lock);
+    free(wc->buckets);
+    free(wc->ents);
+    free(wc->data);
+    free(wc);
+}
+
+int wcache_find(struct ddriver_wcache *wc, off_t sector) {
+    int slot;
+
+    for (slot = wc->buckets[WCACHE_BUCKET(wc, sector)]; slot >= 0; slot = wc->ents[slot].next) {
+        if (wc->ents[slot].sector == sector) {
+            return slot;
+        }
+    }
+    return -1;
+}
+/**
+ * @brief 清空缓存，不写回
+ */
+void wcache_drop(struct ddriver_wcache *wc) {
+    int i;
+
+    for (i = 0; i < wc->nr_buckets; i++) {
+        wc->buckets[i] = -1;
+    }
+    wc->nr = 0;
+}
+/**
+ * @brief 写回全部脏扇区并清空缓存，调用者持有wc->lock。
+ *        按扇区号排序后依次写入介质，连续的扇区合并为一次写，写回耗时按介质模型计
+ */
+int wcache_flush(int fd) {
+    struct ddriver_wcache *wc = handles[fd].wcache;
+    struct wcache_ref *refs;
+    char  *merged;
+    int    nr = 0, i, j, k, ret = 0;
+
+    if (wc->nr == 0) {
+        return 0;
+    }
+    refs   = (struct wcache_ref *)malloc(wc->nr * sizeof(struct wcache_ref));
+    merged = (char *)malloc((size_t)wc->nr * disk.iounit_size);
+    if (refs == NULL || merged == NULL) {
+        free(refs);
+        free(merged);
+        return -ENOMEM;
+    }
+    for (i = 0; i < wc->nr; i++) {
+        if (wc->ents[i].sector >= 0) {
+            refs[nr].sector = wc->ents[i].sector;
+            refs[nr].slot   = i;
+            nr++;
+        }
+    }
+    qsort(refs, nr, sizeof(struct wcache_ref), wcache_ref_cmp);
+
+    for (i = 0; i < nr; i = j) {
+        for (j = i + 1; j < nr && refs[j].sector == refs[j - 1].sector + 1; j++);
+        for (k = i; k < j; k++) {
+            memcpy(merged + (size_t)(k - i) * disk.iounit_size, 
+                   wc->data + (size_t)refs[k].slot * disk.iounit_size, disk.iounit_size);
+        }
+        if (media_write(fd, merged, (size_t)(j - i) * disk.iounit_size, 
+                        refs[i].sector * disk.iounit_size) < 0) {
+            ret = -EIO;
+        }
+    }
+    free(refs);
+    free(merged);
+    wcache_drop(wc);
+    ATOMIC_ADD(disk.cnt->stats.flush_ops, 1);
+    return ret;
+}
+/**
+ * @brief 写入缓存，按扇区覆盖已缓存的数据，缓存满时先整体写回
+ */
+int wcache_write(int fd, char *buf, size_t size, off_t offset) {
+    struct ddriver_wcache *wc = handles[fd].wcache;
+    off_t  sector;
+    size_t done;
+    int    slot, bucket, ret;
+
+    for (done = 0; done < size; done += disk.iounit_size) {
+        sector = TO_SECTOR(offset + (off_t)done);
+        slot   = wcache_find(wc, sector);
+        if (slot < 0) {
+            if (wc->nr == wc->capacity) {
+                ret = wcache_flush(fd);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+            slot   = wc->nr++;
+            bucket = WCACHE_BUCKET(wc, sector);
+            wc->ents[slot].sector = sector;
+            wc->ents[slot].next   = wc->buckets[bucket];
+            wc->buckets[bucket]   = slot;
+        }
+        memcpy(wc->data + (size_t)slot * disk.iounit_size, buf + done, disk.iounit_size);
+    }
+    return size;
+}
+/**
+ * @brief 将缓存中的扇区拷贝到buf对应位置，buf为NULL时只计数，返回命中的扇区数
+ */
+int wcache_read(int fd, char *buf, size_t size, off_t offset) {
+    struct ddriver_wcache *wc = handles[fd].wcache;
+    size_t done;
+    int    slot, hit = 0;
+
+    for (done = 0; done < size; done += disk.iounit_size) {
+        slot = wcache_find(wc, TO_SECTOR(offset + (off_t)done));
+        if (slot >= 0) {
+            if (buf != NULL) {
+                memcpy(buf + done, wc->data + (size_t)slot * disk.iounit_size, disk.iounit_size);
+            }
+            hit++;
+        }
+    }
+    return hit;
+}
+/**
+ * @brief 使一段区域的缓存失效(FUA写与discard已直接作用于介质)
+ */
+void wcache_invalidate(int fd, off_t offset, size_t size) {
+    struct ddriver_wcache *wc = handles[fd].wcache;
+    size_t done;
+    int    slot;
+
+    for (done = 0; done < size; done += disk.iounit_size) {
+        slot = wcache_find(wc, TO_SECTOR(offset + (off_t)done));
+        if (slot >= 0) {
+            wc->ents[slot].sector = -1;
+        }
+    }
+}
+/**
+ * @brief 下发一次写：开启写缓存时写入缓存即完成，不计介质延迟；
+ *        DDRIVER_WRITE_FUA或缓存关闭时直接写入介质
+ */
+int dispatch_write(int fd, char *buf, size_t size, off_t offset, int flags) {
+    struct ddriver_wcache *wc = handles[fd].wcache;
+    int ret;
+
+    if (wc == NULL) {
+        return media_write(fd, buf, size, offset);
+    }
+    pthread_mutex_lock(&wc->lock);
+    if (flags & DDRIVER_WRITE_FUA) {
+        wcache_invalidate(fd, offset, size);
+        ret = media_write(fd, buf, size, offset);
+    }
+    else {
+        ret = wcache_write(fd, buf, size, offset);
+        ATOMIC_ADD(disk.cnt->stats.cached_writes, 1);
+    }
+    pthread_mutex_unlock(&wc->lock);
+    return ret;
+}
+/**
+ * @brief 下发一次读：全部命中写缓存时直接返回，否则读介质后以缓存内容覆盖
+ */
+int dispatch_read(int fd, char *buf, size_t size, off_t offset) {
+    struct ddriver_wcache *wc = handles[fd].wcache;
+    int ret, hit;
+
+    if (wc == NULL) {
+        return media_read(fd, buf, size, offset);
+    }
+    pthread_mutex_lock(&wc->lock);
+    hit = wcache_read(fd, NULL, size, offset);
+    if (hit == (int)(size / disk.iounit_size)) {
+        wcache_read(fd, buf, size, offset);
+        ATOMIC_ADD(disk.cnt->stats.cached_reads, 1);
+        ret = size;
+    }
+    else {
+        ret = media_read(fd, buf, size, offset);
+        if (ret >= 0 && hit > 0) {
+            wcache_read(fd, buf, size, offset);
+        }
+    }
+    pthread_mutex_unlock(&wc->lock);
+    return ret;
+}
+
+int plug_req_cmp(const void *a, const void *b) {
+    off_t lhs = ((const struct plug_req *)a)->offset;
+    off_t rhs = ((const struct plug_req *)b)->offset;
+    return (lhs > rhs) - (lhs < rhs);
+}
+/**
+ * @brief 清空plug队列，不下发
+ */
+void plug_drop(int fd) {
+    struct ddriver_plug *plug = &handles[fd].plug;
+    int i;
+
+    for (i = 0; i < plug->nr; i++) {
+        free(plug->reqs[i].buf);
+    }
+    plug->nr = 0;
+}
+/**
+ * @brief 下发plug队列，调用者持有plug->lock
+ * 
+ * 请求按偏移排序后以C-LOOK顺序下发：从当前磁头位置向高地址扫描，
+ * 到达最高的请求后跳回最低的请求继续。扫描中首尾相接的请求合并为一次写。
+ */
+int plug_dispatch(int fd) {
+    struct ddriver_plug *plug = &handles[fd].plug;
+    struct plug_req *reqs = plug->reqs;
+    int nr = plug->nr;
+    int start, i, j, k, cur, prev;
+    int ret = 0, res;
+    size_t size;
+    char *merged;
+
+    if (nr == 0) {
+        return 0;
+    }
+    qsort(reqs, nr, sizeof(struct plug_req), plug_req_cmp);
+    for (start = 0; start < nr && reqs[start].offset < GET_HEAD(fd); start++);
+
+    for (i = 0; i < nr; i = j) {
+        size = reqs[(start + i) % nr].size;
+        for (j = i + 1; j < nr; j++) {
+            cur  = (start + j) % nr;
+            prev = (start + j - 1) % nr;
+            if (cur == 0 || reqs[prev].offset + (off_t)reqs[prev].size != reqs[cur].offset) {
+                break;                               /* 回绕或不连续，结束本次合并 */
+            }
+            size += reqs[cur].size;
+        }
+
+        cur = (start + i) % nr;
+        if (j - i == 1) {
+            res = dispatch_write(fd, reqs[cur].buf, size, reqs[cur].offset, 0);
+        }
+        else {
+            merged = (char *)malloc(size);
+            if (merged == NULL) {
+                ret = -ENOMEM;
+                break;
+            }
+            for (k = i, size = 0; k < j; k++) {
+                prev = (start + k) % nr;
+                memcpy(merged + size, reqs[prev].buf, reqs[prev].size);
+                size += reqs[prev].size;
+            }
+            res = dispatch_write(fd, merged, size, reqs[cur].offset, 0);
+            free(merged);
+        }
+        if (res < 0) {
+            ret = res;
+        }
+    }
+    plug_drop(fd);
+    return ret;
+}
+/**
+ * @brief plug期间的写：覆盖已排队的请求时原地更新，部分重叠时先下发队列再排队；
+ *        持锁后发现已被unplug则直接写入，队列无法扩容时下发队列后直接写入
+ */
+int plug_queue(int fd, char *buf, size_t size, off_t offset) {
+    struct ddriver_plug *plug = &handles[fd].plug;
+    struct plug_req *req, *reqs;
+    int i, cap, ret = size;
+
+    pthread_mutex_lock(&plug->lock);
+    if (!plug->plugged) {                             /* 与ddriver_unplug竞争，队列已下发 */
+        pthread_mutex_unlock(&plug->lock);
+        return dispatch_write(fd, buf, size, offset, 0);
+    }
+    for (i = 0; i < plug->nr; i++) {
+        req = &plug->reqs[i];
+        if (IS_CONTAIN(req->offset, req->size, offset, size)) {
+            memcpy(req->buf + (offset - req->offset), buf, size);
+            goto out;
+        }
+    }
+    for (i = 0; i < plug->nr; i++) {
+        req = &plug->reqs[i];
+        if (IS_OVERLAP(req->offset, req->size, offset, size)) {
+            ret = plug_dispatch(fd);
+            break;
+        }
+    }
+    if (ret < 0) {
+        goto out;
+    }
+
+    if (plug->nr == plug->cap) {
+        cap  = plug->cap ? plug->cap * 2 : CONFIG_PLUG_DEPTH;
+        reqs = (struct plug_req *)realloc(plug->reqs, cap * sizeof(struct plug_req));
+        if (reqs == NULL) {                           /* 原队列保持不变，按序下发后直接写入 */
+            user_alert("can't grow plug queue to %d, write through", cap);
+            ret = plug_dispatch(fd);
+            if (ret >= 0) {
+                ret = dispatch_write(fd, buf, size, offset, 0);
+            }
+            goto out;
+        }
+        plug->reqs = reqs;
+        plug->cap  = cap;
+    }
+    req = &plug->reqs[plug->nr];
+    req->buf = (char *)malloc(size);
+    if (req->buf == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    memcpy(req->buf, buf, size);
+    req->offset = offset;
+    req->size   = size;
+    plug->nr++;
+
+    if (plug->nr >= CONFIG_PLUG_DEPTH) {
+        ret = plug_dispatch(fd);
+    }
+out:
+    pthread_mutex_unlock(&plug->lock);
+    return ret < 0 ? ret : (int)size;
+}
+/**
+ * @brief plug期间的读：被某个排队请求完全覆盖时直接从队列返回1，
+ *        部分重叠时先下发队列，返回0表示需要访问设备(包括持锁后发现已被unplug)，
+ *        下发失败返回负的错误码
+ */
+int plug_lookup(int fd, char *buf, size_t size, off_t offset) {
+    struct ddriver_plug *plug = &handles[fd].plug;
+    struct plug_req *req;
+    int i, hit = 0;
+
+    pthread_mutex_lock(&plug->lock);
+    for (i = 0; plug->plugged && i < plug->nr; i++) {
+        req = &plug->reqs[i];
+        if (IS_CONTAIN(req->offset, req->size, offset, size)) {
+            memcpy(buf, req->buf + (offset - req->offset), size);
+            hit = 1;
+            break;
+        }
+        if (IS_OVERLAP(req->offset, req->size, offset, size)) {
+            hit = plug_dispatch(fd);                  /* 0或负的错误码 */
+            break;
+        }
+    }
+    pthread_mutex_unlock(&plug->lock);
+    return hit;
+}
+/**
+ * @brief 丢弃[offset, offset + len)：先下发plug队列保证顺序，不移动磁头，不计延迟
+ */
+int discard_range(int fd, struct ddriver_discard *range) {
+    off_t offset = range->offset;
+    off_t len    = range->len;
+    off_t chunk;
+    int   ret;
+
+    if (len <= 0 || !IS_ADDR_ALIGN(offset) || !IS_ADDR_ALIGN(len)) {
+        user_alert("discard [%lld, +%lld) must be aligned to block size %d", 
+                   range->offset, range->len, disk.iounit_size);
+        return -EINVAL;
+    }
+    if (!IS_IN_DEVICE(offset, len)) {
+        user_alert("discard [%lld, +%lld) out of device", range->offset, range->len);
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&handles[fd].plug.lock);
+    ret = plug_dispatch(fd);
+    pthread_mutex_unlock(&handles[fd].plug.lock);
+    if (ret < 0) {
+        return ret;
+    }
+    if (handles[fd].wcache != NULL) {
+        pthread_mutex_lock(&handles[fd].wcache->lock);
+        wcache_invalidate(fd, offset, len);
+        pthread_mutex_unlock(&handles[fd].wcache->lock);
+    }
+    ret = backend_discard(fd, offset, len);
+    if (ret < 0) {
+        return ret;
+    }
+    flash_trim(offset, len);
+
+    ATOMIC_ADD(disk.cnt->stats.discard_ops, 1);
+    ATOMIC_ADD(disk.cnt->stats.discard_bytes, (long long)len);
+    for (; len > 0; offset += chunk, len -= chunk) {  /* 轨迹记录的size为int，按1G切分 */
+        chunk = len > (1 << 30) ? (1 << 30) : len;
+        trace_record(DDRIVER_OP_DISCARD, offset, chunk);
+    }
+    return 0;
+}
+/**
+ * @brief 整盘重置：丢弃plug队列后对整个镜像打洞，与镜像大小无关，近似O(1)
+ */
+int device_reset(int fd) {
+    int ret;
+
+    pthread_mutex_lock(&handles[fd].plug.lock);
+    plug_drop(fd);
+    pthread_mutex_unlock(&handles[fd].plug.lock);
+    if (handles[fd].wcache != NULL) {
+        pthread_mutex_lock(&handles[fd].wcache->lock);
+        wcache_drop(handles[fd].wcache);
+        pthread_mutex_unlock(&handles[fd].wcache->lock);
+    }
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+    ret = backend_discard(fd, 0, disk.layout_size);
+    if (disk.flash != NULL) {
+        flash_reset(disk.flash);
+    }
+    SET_HEAD(fd, 0);
+    stats_reset();
+    return ret;
+}
+/**
+ * @brief 拷贝模板镜像：优先FICLONE共享数据块，其次copy_file_range由内核拷贝，
+ *        均不可用(跨文件系统、条带化)时逐块读写并跳过全0块，保持稀疏
+ */
+int template_copy(int fd, int tfd, off_t size) {
+    static char buf[MAX_BLOCK_SZ];
+    static char zero[MAX_BLOCK_SZ];
+    off_t   pos = 0;
+    ssize_t res;
 
-#define RW_DELAY(disk, rw_ops)  (usleep(disk.rw_ops##_lat * 1000))
-/******************************************************************************
-* SECTION: Type definitions
-*******************************************************************************/
-struct ddriver
-{
-    int  ddriver_fd;                                 /* Disk ddriver_fd */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
-    int  read_lat;
-    int  write_lat;
-    int  seek_lat;
-    int  track_num;
-    int  major_num;
-    int  layout_size;
-    int  iounit_size;
-};
-/******************************************************************************
-* SECTION: Global Variable
-*******************************************************************************/
-/* reference: https://en.wikipedia.org/wiki/Hard_disk_drive_performance_characteristics */
-struct ddriver disk = {
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
-    .read_lat    = 2,       /* 2ms */       
-    .write_lat   = 1,       /* 1ms */
-    .seek_lat    = 4,       /* 4.17ms per 360 degree */
-    .major_num   = 0,
-    .track_num   = 100,
-    .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
-};
+    if (handles[fd].stripe == NULL) {
+        if (size == disk.layout_size && ioctl(fd, FICLONE, tfd) == 0) {
+            return 0;
+        }
+        while (pos < size) {
+            res = copy_file_range(tfd, &pos, fd, &pos, size - pos, 0);
+            if (res <= 0) {
+                break;
+            }
+        }
+        if (pos == size) {
+            return 0;
+        }
+    }
 
-FILE *debugf = NULL;
-/******************************************************************************
-* SECTION: Helper Functions
-*******************************************************************************/
-int check_valid(size_t size) {
-    if (size != CONFIG_BLOCK_SZ){
-        user_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
-        return -EIO;
+    for (; pos < size; pos += res) {
+        res = pread(tfd, buf, size - pos > MAX_BLOCK_SZ ? MAX_BLOCK_SZ : size - pos, pos);
+        if (res <= 0) {
+            return -EIO;
+        }
+        if (memcmp(buf, zero, res) != 0 && backend_pwrite(fd, buf, res, pos) != res) {
+            return -EIO;
+        }
     }
     return 0;
 }
+/**
+ * @brief 以模板镜像重置设备，模板不足设备大小的部分为0
+ */
+int device_reset_from(int fd, const char *path) {
+    struct stat st;
+    int tfd, ret;
 
-int emulate_rotate(int fd, off_t start, off_t end) {
-    int bytes_per_track = disk.layout_size / disk.track_num;
-    int lat_per_track = disk.seek_lat;
-    int distance = abs(end - start) % bytes_per_track; 
-    
-    if (distance == 0) {
-        return 0;
+    tfd = open(path, O_RDONLY);
+    if (tfd < 0) {
+        user_alert("can't open template %s: %s", path, strerror(errno));
+        return -ENOENT;
+    }
+    if (fstat(tfd, &st) < 0 || st.st_size > disk.layout_size || !IS_ADDR_ALIGN(st.st_size)) {
+        user_alert("template %s doesn't fit device", path);
+        close(tfd);
+        return -EINVAL;
     }
 
-    usleep(distance * lat_per_track / bytes_per_track * 1000);
-    return 0;
+    ret = device_reset(fd);
+    if (ret == 0) {
+        ret = template_copy(fd, tfd, st.st_size);
+    }
+    close(tfd);
+    return ret;
+}
+/**
+ * @brief 调整写缓存大小，先写回原有缓存；bytes为0时关闭
+ */
+int wcache_resize(int fd, long long bytes) {
+    struct ddriver_wcache *wc = handles[fd].wcache;
+    int ret = 0;
+
+    if (wc != NULL) {
+        pthread_mutex_lock(&wc->lock);
+        ret = wcache_flush(fd);
+        handles[fd].wcache = NULL;
+        pthread_mutex_unlock(&wc->lock);
+        wcache_teardown(wc);
+    }
+    if (bytes > 0) {
+        handles[fd].wcache = wcache_setup(bytes);
+        if (handles[fd].wcache == NULL) {
+            return -ENOMEM;
+        }
+    }
+    return ret;
 }
 /******************************************************************************
 * SECTION: Global Function Implementation
@@ -128,6 +2277,9 @@ int ddriver_open(char *path) {
     int fd, ret = 0;
     char device_path[128] = {0};
     char log_path[128] = {0};
+    char member_path[160] = {0};
+    char *backend;
+    int  shm;
     
     sprintf(device_path, "%s/" DEVICE_NAME, getpwuid(getuid())->pw_dir);
     sprintf(log_path, "%s/" DEVICE_LOG, getpwuid(getuid())->pw_dir);
@@ -137,29 +2289,112 @@ int ddriver_open(char *path) {
         return -1;
     }
 
-    if (access(device_path, F_OK) == 0) {
-        fd = open(device_path, O_RDWR);
+    ret = stripe_config();
+    if (ret < 0) {
+        return ret;
+    }
+    backend = getenv(ENV_BACKEND);
+    shm = backend != NULL && strcmp(backend, "shm") == 0;
+    if (shm && disk.stripe_nr > 1) {
+        user_panic("shm backend is not supported on striped device");
+        return -EINVAL;
+    }
+    if (disk.stripe_nr > 1) {                        /* 条带化时成员为<path>.0 ~ <path>.<n-1> */
+        sprintf(member_path, "%s.0", device_path);
     }
     else {
-        fd = open(device_path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+        strcpy(member_path, device_path);
     }
+    fd = shm ? shm_attach(device_path) : device_open(member_path);
     if (fd < 0) {
         user_panic("can't open device: %d", fd);
         return fd;
     }
-    ret = posix_fallocate(fd, 0, CONFIG_DISK_SZ);
+    if (fd >= MAX_HANDLES) {
+        user_panic("too many handles: %d", fd);
+        ret = -EMFILE;
+        goto err_close;
+    }
+    if (!shm) {                                       /* shm后端的几何取自共享内存头 */
+        ret = geometry_setup(fd);
+    }
+    if (ret == 0) {
+        ret = latency_setup();
+    }
     if (ret < 0) {
-        user_panic("low space");
-        return ret;
+        goto err_close;
     }
-
-    debugf = fopen(log_path, "w+");
-    if (debugf == NULL) {
+    ret = flash_setup();                              /* 失败时自行释放 */
+    if (ret < 0) {
+        goto err_close;
+    }
+    ret = trace_setup();
+    if (ret < 0) {
+        goto err_flash;
+    }
+    if (log_setup(log_path) < 0) {
         user_panic("can't init log: %s", log_path);
-        return -1;
+        ret = -EIO;
+        goto err_trace;
+    }
+
+    handles[fd].is_open = 1;
+    handles[fd].backend = DDRIVER_BACKEND_FILE;
+    handles[fd].map     = NULL;
+    handles[fd].last_end = 0;
+    handles[fd].aio     = NULL;
+    handles[fd].plug.plugged = 0;
+    handles[fd].plug.nr      = 0;
+    handles[fd].plug.cap     = 0;
+    handles[fd].plug.reqs    = NULL;
+    pthread_mutex_init(&handles[fd].plug.lock, NULL);
+    handles[fd].stripe  = NULL;
+    handles[fd].wcache  = NULL;
+    SET_HEAD(fd, 0);
+
+    if (disk.stripe_nr > 1) {
+        ret = stripe_setup(fd, device_path);
+        if (ret < 0) {
+            goto err_handle;
+        }
+    }
+    if (getenv(ENV_WCACHE) != NULL) {
+        wcache_resize(fd, parse_size(getenv(ENV_WCACHE)));
     }
 
+    if (shm || (backend != NULL && strcmp(backend, "mmap") == 0)) {
+        ret = backend_attach(fd, DDRIVER_BACKEND_MMAP);
+        if (ret < 0) {
+            goto err_wcache;
+        }
+    }
+    ATOMIC_ADD(nr_open, 1);
     return fd;
+
+    /* 按初始化的逆序撤销，进程级状态只在没有其他handle打开时释放 */
+err_wcache:
+    wcache_resize(fd, 0);
+err_handle:
+    stripe_teardown(fd);
+    pthread_mutex_destroy(&handles[fd].plug.lock);
+    handles[fd].is_open = 0;
+    if (nr_open == 0) {
+        log_teardown();
+    }
+err_trace:
+    if (nr_open == 0) {
+        trace_teardown();
+    }
+err_flash:
+    if (nr_open == 0) {
+        flash_teardown();
+    }
+err_close:
+    if (nr_open == 0) {
+        shm_detach(fd);
+    }
+    close(fd);
+    return ret;
 }
 /**
  * @brief 关闭驱动
@@ -168,7 +2403,28 @@ int ddriver_open(char *path) {
  * @return int 
  */
 int ddriver_close(int fd) {
-    return close(fd) && fclose(debugf);
+    if (IS_HANDLE_VALID(fd)) {
+        if (handles[fd].aio != NULL) {
+            aio_teardown(handles[fd].aio);
+            handles[fd].aio = NULL;
+        }
+        ddriver_unplug(fd);
+        free(handles[fd].plug.reqs);
+        handles[fd].plug.reqs = NULL;
+        handles[fd].plug.cap  = 0;
+        pthread_mutex_destroy(&handles[fd].plug.lock);
+        wcache_resize(fd, 0);                         /* 正常关闭，写回缓存 */
+        backend_attach(fd, DDRIVER_BACKEND_FILE);
+        stripe_teardown(fd);
+        handles[fd].is_open = 0;
+        if (ATOMIC_ADD(nr_open, -1) == 0) {
+            trace_teardown();
+            flash_teardown();
+            shm_detach(fd);
+            log_teardown();
+        }
+    }
+    return close(fd);
 }
 /**
  * @brief 磁盘头SEEK
@@ -176,27 +2432,171 @@ int ddriver_close(int fd) {
  * @param fd 
  * @param offset 
  * @param whence 
- * @return int 
+ * @return off_t 移动后的位置，失败返回负的错误码
  */
-int ddriver_seek(int fd, off_t offset, int whence){
-    int ret = 0;
-    int cur = 0;
+off_t ddriver_seek(int fd, off_t offset, int whence){
+    off_t cur = 0;
+    off_t pos = 0;
 
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
+    }
     if (!IS_ADDR_ALIGN(offset)) {
         user_alert("offset %ld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk.iounit_size);
+        return -EINVAL;
+    }
+
+    cur = GET_HEAD(fd);
+    switch (whence)
+    {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = cur + offset;
+        break;
+    case SEEK_END:
+        pos = disk.layout_size + offset;
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (pos < 0 || pos > disk.layout_size) {
+        user_panic("seek error: %ld out of device", pos);
         return -EINVAL;
     }
 
     INC_SEEKCNT(disk);
-    cur = lseek(fd, 0, SEEK_CUR);
-    ret = lseek(fd, offset, whence);
-    if (ret < 0) {
-        user_panic("seek error: %s", strerror(errno));
-        return ret;
+    emulate_rotate(fd, cur, pos);
+    SET_HEAD(fd, pos);
+    trace_record(DDRIVER_OP_SEEK, pos, 0);
+    return pos;
+}
+/**
+ * @brief 定位写入，旋转延迟由该handle的逻辑磁盘头计算，写入介质后磁盘头移到写入结尾
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 必须为IO单位的整数倍
+ * @param offset 必须与IO单位对齐
+ * @return int 写入字节数
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset){
+    return ddriver_pwrite2(fd, buf, size, offset, 0);
+}
+/**
+ * @brief 带标志的定位写入
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 必须为IO单位的整数倍
+ * @param offset 必须与IO单位对齐
+ * @param flags DDRIVER_WRITE_FUA：绕过plug队列与写缓存，返回时数据已在介质上
+ * @return int 写入字节数
+ */
+int ddriver_pwrite2(int fd, char *buf, size_t size, off_t offset, int flags){
+    int res = check_valid_v(size);
+    if(res < 0)
+        return res;
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
     }
-    emulate_rotate(fd, cur, ret);
-    return ret;
+    if (!IS_ADDR_ALIGN(offset)) {
+        user_alert("offset %ld must be aligned to block size %d", 
+                      offset, disk.iounit_size);
+        return -EINVAL;
+    }
+    if (!IS_IN_DEVICE(offset, size)) {
+        user_alert("io [%ld, +%ld) out of device", offset, size);
+        return -EINVAL;
+    }
+
+    if (flags & DDRIVER_WRITE_FUA) {                  /* 之前排队的写先于FUA写落盘 */
+        pthread_mutex_lock(&handles[fd].plug.lock);
+        res = plug_dispatch(fd);
+        pthread_mutex_unlock(&handles[fd].plug.lock);
+        if (res < 0) {
+            return res;
+        }
+        return dispatch_write(fd, buf, size, offset, flags);
+    }
+    if (IS_PLUGGED(fd)) {
+        return plug_queue(fd, buf, size, offset);
+    }
+    return dispatch_write(fd, buf, size, offset, 0);
+}
+/**
+ * @brief 定位读出，旋转延迟由该handle的逻辑磁盘头计算，读出介质后磁盘头移到读出结尾
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 必须为IO单位的整数倍
+ * @param offset 必须与IO单位对齐
+ * @return int 读出字节数
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset){
+    int res = check_valid_v(size);
+    if(res < 0)
+        return res;
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
+    }
+    if (!IS_ADDR_ALIGN(offset)) {
+        user_alert("offset %ld must be aligned to block size %d", 
+                      offset, disk.iounit_size);
+        return -EINVAL;
+    }
+    if (!IS_IN_DEVICE(offset, size)) {
+        user_alert("io [%ld, +%ld) out of device", offset, size);
+        return -EINVAL;
+    }
+
+    if (IS_PLUGGED(fd)) {
+        res = plug_lookup(fd, buf, size, offset);
+        if (res < 0) {
+            return res;
+        }
+        if (res) {
+            return size;
+        }
+    }
+    return dispatch_read(fd, buf, size, offset);
+}
+/**
+ * @brief 从磁盘头处写入并把磁盘头推进到写入结尾。plug队列吸收的写不经过media_*，
+ * 磁盘头只能在这里推进
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 
+ * @return int 写入字节数
+ */
+int head_pwrite(int fd, char *buf, size_t size) {
+    off_t head = GET_HEAD(fd);
+    int   res  = ddriver_pwrite(fd, buf, size, head);
+
+    if (res > 0) {
+        SET_HEAD(fd, head + res);
+    }
+    return res;
+}
+/**
+ * @brief 从磁盘头处读出并把磁盘头推进到读出结尾，plug队列命中的读同样推进
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 
+ * @return int 读出字节数
+ */
+int head_pread(int fd, char *buf, size_t size) {
+    off_t head = GET_HEAD(fd);
+    int   res  = ddriver_pread(fd, buf, size, head);
+
+    if (res > 0) {
+        SET_HEAD(fd, head + res);
+    }
+    return res;
 }
 /**
  * @brief 磁盘写入，写入大小可通过IOCTL查询
@@ -210,12 +2610,10 @@ int ddriver_write(int fd, char *buf, size_t size){
     int res = check_valid(size);
     if(res < 0)
         return res;
-        
-    RW_DELAY(disk, write);
-    write(fd, buf, size);
-
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
+    }
+    return head_pwrite(fd, buf, size);
 }
 /**
  * @brief 
@@ -229,12 +2627,150 @@ int ddriver_read(int fd, char *buf, size_t size){
     int res = check_valid(size);
     if(res < 0)
         return res;
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
+    }
+    return head_pread(fd, buf, size);
+}
+/**
+ * @brief 从磁盘头处连续写入多个IO单位：经head_pwrite作为一个ddriver_pwrite请求下发(可能进入plug队列或写缓存)，
+ *        到达介质时只计一次写延迟，完成后磁盘头推进到写入结尾
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 必须为IO单位的整数倍
+ * @return int 写入字节数
+ */
+int ddriver_writev(int fd, char *buf, size_t size){
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
+    }
+    return head_pwrite(fd, buf, size);
+}
+/**
+ * @brief 从磁盘头处连续读出多个IO单位：经head_pread作为一个ddriver_pread请求(可能由plug队列或写缓存命中)，
+ *        访问介质时只计一次读延迟，完成后磁盘头推进到读出结尾
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 必须为IO单位的整数倍
+ * @return int 读出字节数
+ */
+int ddriver_readv(int fd, char *buf, size_t size){
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
+    }
+    return head_pread(fd, buf, size);
+}
+/**
+ * @brief 批量提交异步IO，立即返回，完成后通过ddriver_getevents取回
+ * 
+ * @param fd 
+ * @param ios 
+ * @param nr 
+ * @return int 提交的请求数，队列创建失败返回-ENOMEM
+ */
+int ddriver_submit(int fd, struct ddriver_io **ios, int nr) {
+    struct ddriver_aio *aio;
+    int i;
+
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
+    }
+    if (handles[fd].aio == NULL) {
+        handles[fd].aio = aio_setup(fd);
+    }
+    aio = handles[fd].aio;
+    if (aio == NULL) {
+        return -ENOMEM;
+    }
+    if (aio->nr_workers == 0) {
+        return -EAGAIN;
+    }
+
+    pthread_mutex_lock(&aio->lock);
+    for (i = 0; i < nr; i++) {
+        ios[i]->submit_ns = ATOMIC_LOAD(disk.cnt->vclock);
+        aio_enqueue(&aio->pending_head, &aio->pending_tail, ios[i]);
+    }
+    aio->inflight += nr;
+    pthread_cond_broadcast(&aio->submit_cond);
+    pthread_mutex_unlock(&aio->lock);
+    return nr;
+}
+/**
+ * @brief 取回已完成的异步IO，至少等待min_nr个(不超过在途请求数)
+ * 
+ * @param fd 
+ * @param min_nr 
+ * @param max_nr 
+ * @param events 完成的请求，res为对应同步接口的返回值
+ * @return int 取回的请求数
+ */
+int ddriver_getevents(int fd, int min_nr, int max_nr, struct ddriver_io **events) {
+    struct ddriver_aio *aio;
+    struct ddriver_io  *io;
+    int done = 0;
+
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
+    }
+    aio = handles[fd].aio;
+    if (aio == NULL) {
+        return 0;
+    }
 
-    RW_DELAY(disk, read);
-    read(fd, buf, size);
+    pthread_mutex_lock(&aio->lock);
+    if (min_nr > aio->inflight) {
+        min_nr = aio->inflight;
+    }
+    while (done < max_nr) {
+        io = aio_dequeue(&aio->complete_head, &aio->complete_tail);
+        if (io == NULL) {
+            if (done >= min_nr) {
+                break;
+            }
+            pthread_cond_wait(&aio->complete_cond, &aio->lock);
+            continue;
+        }
+        events[done++] = io;
+        aio->inflight--;
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return done;
+}
+/**
+ * @brief 开始积攒写请求，之后的写只进入队列，由ddriver_unplug统一排序合并后下发
+ * 
+ * @param fd 
+ * @return int 
+ */
+int ddriver_plug(int fd) {
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
+    }
+    pthread_mutex_lock(&handles[fd].plug.lock);
+    __atomic_store_n(&handles[fd].plug.plugged, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&handles[fd].plug.lock);
+    return 0;
+}
+/**
+ * @brief 按C-LOOK顺序下发积攒的写请求，相邻请求合并为一次写
+ * 
+ * @param fd 
+ * @return int 
+ */
+int ddriver_unplug(int fd) {
+    int ret;
 
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    if (!IS_HANDLE_VALID(fd)) {
+        return -EBADF;
+    }
+    pthread_mutex_lock(&handles[fd].plug.lock);
+    ret = plug_dispatch(fd);
+    __atomic_store_n(&handles[fd].plug.plugged, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&handles[fd].plug.lock);
+    return ret;
 }
 /**
  * @brief 
@@ -246,32 +2782,93 @@ int ddriver_read(int fd, char *buf, size_t size){
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
     struct ddriver_state state;
+    int size;
+    long long size64;
     switch (cmd)
     {
-    case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        memcpy(arg, &disk.layout_size, sizeof(int));
+    case IOC_REQ_DEVICE_SIZE:                         /* Device Size, clamp to int */
+        size = disk.layout_size > INT_MAX ? ADDR_ROUND_UP(INT_MAX) : disk.layout_size;
+        memcpy(arg, &size, sizeof(int));
+        break;
+    case IOC_REQ_DEVICE_SIZE64:                       /* Device Size, 64 bit */
+        size64 = disk.layout_size;
+        memcpy(arg, &size64, sizeof(long long));
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        state.read_cnt = disk.cnt->read_cnt;
+        state.write_cnt = disk.cnt->write_cnt;
+        state.seek_cnt = disk.cnt->seek_cnt;
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        lseek(fd, 0, SEEK_SET);
-        char buf[4096] = {'\0'};
-        for (size_t i = 0; i < CONFIG_DISK_SZ; i += 4096)
-        {
-            write(fd, buf, 4096);
-        }
-        lseek(fd, 0, SEEK_SET);
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
-        break;
+        if (!IS_HANDLE_VALID(fd)) {
+            return -EBADF;
+        }
+        return device_reset(fd);
+    case IOC_REQ_DEVICE_RESET_FROM:                   /* Reset Device from template image */
+        if (!IS_HANDLE_VALID(fd)) {
+            return -EBADF;
+        }
+        return device_reset_from(fd, (const char *)arg);
     case IOC_REQ_DEVICE_IO_SZ:
         memcpy(arg, &disk.iounit_size, sizeof(int));
         break;
+    case IOC_REQ_DEVICE_BACKEND:                      /* Switch Backend */
+        if (!IS_HANDLE_VALID(fd)) {
+            return -EBADF;
+        }
+        return backend_attach(fd, *(int *)arg);
+    case IOC_REQ_DEVICE_LAT_MODE:                     /* Latency Mode */
+        if (*(int *)arg < DDRIVER_LAT_SLEEP || *(int *)arg > DDRIVER_LAT_NONE) {
+            return -EINVAL;
+        }
+        disk.lat_mode = *(int *)arg;
+        break;
+    case IOC_REQ_DEVICE_CLOCK:                        /* Virtual Clock */
+        size64 = ATOMIC_LOAD(disk.cnt->vclock);
+        memcpy(arg, &size64, sizeof(long long));
+        break;
+    case IOC_REQ_DEVICE_STATS:                        /* Extended Stats */
+        disk.cnt->stats.seek_ops = disk.cnt->seek_cnt;
+        memcpy(arg, &disk.cnt->stats, sizeof(struct ddriver_stats));
+        break;
+    case IOC_REQ_DEVICE_STATS_RESET:                  /* Reset counters only */
+        stats_reset();
+        break;
+    case IOC_REQ_DEVICE_WCACHE:                       /* Resize write cache, 0 to disable */
+        if (!IS_HANDLE_VALID(fd)) {
+            return -EBADF;
+        }
+        return wcache_resize(fd, *(long long *)arg);
+    case IOC_REQ_DEVICE_DISCARD:                      /* Discard (TRIM) a range */
+        if (!IS_HANDLE_VALID(fd)) {
+            return -EBADF;
+        }
+        return discard_range(fd, (struct ddriver_discard *)arg);
+    case IOC_REQ_DEVICE_FLUSH:                        /* Flush plug queue, write cache, backing file */
+        if (IS_HANDLE_VALID(fd)) {
+            pthread_mutex_lock(&handles[fd].plug.lock);
+            size = plug_dispatch(fd);
+            pthread_mutex_unlock(&handles[fd].plug.lock);
+            if (size < 0) {
+                return size;
+            }
+        }
+        if (IS_HANDLE_VALID(fd) && handles[fd].wcache != NULL) {
+            pthread_mutex_lock(&handles[fd].wcache->lock);
+            size = wcache_flush(fd);
+            pthread_mutex_unlock(&handles[fd].wcache->lock);
+            if (size < 0) {
+                return size;
+            }
+        }
+        if (IS_HANDLE_VALID(fd) && disk.shm != NULL) {
+            return shm_writeback(fd);
+        }
+        if (IS_HANDLE_VALID(fd) && handles[fd].backend == DDRIVER_BACKEND_MMAP) {
+            return msync(handles[fd].map, disk.layout_size, MS_SYNC);
+        }
+        return stripe_sync(fd);
     default:
         break;
     }
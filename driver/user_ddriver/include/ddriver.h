@@ -4,11 +4,247 @@
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
 
+/**
+ * 并发约定(用户态驱动)：
+ *   1) 同一handle上的ddriver_pread/ddriver_pwrite/ddriver_pwrite2、
+ *      ddriver_submit/ddriver_getevents、ddriver_plug/ddriver_unplug，以及
+ *      IOC_REQ_DEVICE_FLUSH/DISCARD/STATS/CLOCK/SIZE等查询类ioctl可由多个线程并发调用；
+ *      与ddriver_unplug并发的写要么在其返回前随队列下发，要么直接下发，之后的读总能看到；
+ *   2) ddriver_read/ddriver_write/ddriver_readv/ddriver_writev/ddriver_seek依赖handle的磁盘头，多线程共享handle时
+ *      结果取决于调度顺序，应改用带offset的接口；
+ *   3) ddriver_open/ddriver_close，以及RESET/RESET_FROM/BACKEND/WCACHE/LAT_MODE/STATS_RESET
+ *      等改变设备状态的ioctl须在该handle上没有IO在途时调用；
+ *   4) 计数、统计与虚拟时钟均为原子累加，IOC_REQ_DEVICE_STATS返回的各字段之间不保证是同一时刻的快照；
+ *   5) 条带化设备上同一时刻只分发一个IO(其各成员并行)，写缓存开启时访问缓存的IO互斥。
+ */
+
+#define DDRIVER_OP_READ     0
+#define DDRIVER_OP_WRITE    1
+#define DDRIVER_OP_SEEK     2                 /* 仅出现在轨迹中 */
+#define DDRIVER_OP_DISCARD  3                 /* 仅出现在轨迹中 */
+
+#define DDRIVER_WRITE_FUA   0x1               /* 强制写入介质，不经过写缓存 */
+
+/**
+ * @brief 异步IO请求，由调用者分配，完成前不可释放或修改
+ */
+struct ddriver_io
+{
+    int                op;              /* DDRIVER_OP_READ / DDRIVER_OP_WRITE */
+    char              *buf;             /* 数据Buf */
+    size_t             size;            /* 必须为单次设备IO单位的整数倍 */
+    off_t              offset;          /* 注意要和设备IO单位对齐 */
+    int                res;             /* 完成后填入，含义同ddriver_pread/ddriver_pwrite返回值 */
+    int                flags;           /* 写请求的DDRIVER_WRITE_*标志 */
+    long long          submit_ns;       /* 提交时的虚拟时钟(纳秒)，驱动填入 */
+    long long          complete_ns;     /* 完成时的虚拟时钟，减去submit_ns即含排队的模拟响应时间 */
+    void              *priv;            /* 调用者私有数据，驱动不使用 */
+    struct ddriver_io *next;            /* 驱动内部使用 */
+};
+
+#define DDRIVER_TRACE_MAGIC     0x52544444    /* "DDTR" */
+#define DDRIVER_TRACE_VERSION   1
+
+/**
+ * @brief 块IO轨迹文件头，设置环境变量DDRIVER_TRACE=<路径>后由ddriver_open写入
+ */
+struct ddriver_trace_hdr
+{
+    int       magic;
+    int       version;
+    int       iounit_size;                  /* 录制时的设备IO单位 */
+    int       reserved;
+    long long layout_size;                  /* 录制时的设备大小 */
+};
+
+/**
+ * @brief 块IO轨迹记录，紧跟文件头依次追加，每次seek/读/写一条
+ */
+struct ddriver_trace_rec
+{
+    long long ts_ns;                        /* 距开始录制的纳秒数 */
+    long long offset;
+    int       size;                         /* seek为0 */
+    int       op;                           /* DDRIVER_OP_* */
+};
+
+/**
+ * @brief 打开ddriver设备
+ * 
+ * 用户态驱动在打开时确定设备几何与后端，可通过环境变量配置：
+ *   DDRIVER_DISK_SZ   设备大小，支持K/M/G后缀；未设置时沿用已有镜像大小，否则为4M
+ *   DDRIVER_BLOCK_SZ  设备IO单位，512~64K的2的幂，默认512
+ *   DDRIVER_BACKEND   file(默认)、mmap 或 shm：shm以共享内存段/dev/shm/ddriver-<uid>作为设备，
+ *                     多个进程(如FUSE守护进程与fsck、基准程序)可同时打开，共享数据与计数；
+ *                     第一个打开的进程从镜像载入，IOC_REQ_DEVICE_FLUSH与最后一个进程关闭时写回镜像。
+ *                     几何由创建者确定，写缓存、plug队列与ssd模型的FTL仍为各进程私有
+ *   DDRIVER_LATENCY   sleep(默认)、virtual(仅累加虚拟时钟)或 none
+ *   DDRIVER_TRACE     录制块IO轨迹到该路径，可用tests/ddriver_replay回放
+ *   DDRIVER_STRIPE    RAID-0成员数(2~16)，成员镜像为<path>.0 ~ <path>.<n-1>，
+ *                     跨成员的IO由各成员线程并行完成，延迟按传输量最大的成员计
+ *   DDRIVER_STRIPE_UNIT 条带单位，设备IO单位的整数倍，默认64K
+ *   DDRIVER_WCACHE    开启该大小的易失写缓存：写入缓存即完成，IOC_REQ_DEVICE_FLUSH、
+ *                     缓存满或ddriver_close时写回并计入介质延迟；读优先由缓存返回
+ *   DDRIVER_MODEL     hdd(默认，寻道与旋转延迟)或 ssd(页映射FTL：无寻道，按页计读/编程延迟，
+ *                     写满后贪心GC并按块擦除，写放大与GC停顿见ddriver_stats)
+ *   DDRIVER_FLASH_PAGE  ssd模型的页大小，设备IO单位的整数倍，默认4K
+ *   DDRIVER_FLASH_BLOCK ssd模型的擦除块大小，页大小的整数倍，默认256K
+ *   DDRIVER_FLASH_OP    ssd模型的预留空间，逻辑容量的百分比，默认7
+ * 镜像按需稀疏扩展，超过2GB的设备请使用IOC_REQ_DEVICE_SIZE64查询大小
+ * 驱动日志由后台线程追加到~/ddriver_log(ddriver -l查看)，只有PANIC同时打印到stdout；
+ * 编译驱动时make LOG_LEVEL=0/1/2分别只保留PANIC/WARNING/全部日志
+ * 
+ * @param path ddriver设备路径
+ * @return int 0成功，否则失败
+ */
 int ddriver_open(char *path);
-int ddriver_seek(int fd, off_t offset, int whence);
+
+/**
+ * @brief 移动ddriver磁盘头
+ * 
+ * @param fd ddriver设备handler
+ * @param offset 移动到的位置，注意要和设备IO单位对齐
+ * @param whence SEEK_SET即可
+ * @return off_t 成功返回移动后的位置(可超过2GiB)，否则返回负的错误码
+ */
+off_t ddriver_seek(int fd, off_t offset, int whence);
+
+/**
+ * @brief 写入数据
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，注意一定要等于单次设备IO单位
+ * @return int 0成功，否则失败
+ */
 int ddriver_write(int fd, char *buf, size_t size);
+
+/**
+ * @brief 读出数据
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，注意一定要等于单次设备IO单位
+ * @return int 
+ */
 int ddriver_read(int fd, char *buf, size_t size);
+
+/**
+ * @brief 从磁盘头处连续写入多个IO单位，作为一个ddriver_pwrite请求下发，到达介质时只计一次写延迟，
+ *        完成后磁盘头推进到写入结尾
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，必须为单次设备IO单位的整数倍
+ * @return int 成功返回写入字节数，否则失败
+ */
+int ddriver_writev(int fd, char *buf, size_t size);
+
+/**
+ * @brief 从磁盘头处连续读出多个IO单位，作为一个ddriver_pread请求，访问介质时只计一次读延迟，
+ *        完成后磁盘头推进到读出结尾
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，必须为单次设备IO单位的整数倍
+ * @return int 成功返回读出字节数，否则失败
+ */
+int ddriver_readv(int fd, char *buf, size_t size);
+
+/**
+ * @brief 在指定位置写入，不依赖磁盘头；完成后磁盘头移到写入结尾(用于模拟下一次寻道)
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，必须为单次设备IO单位的整数倍
+ * @param offset 写入位置，注意要和设备IO单位对齐
+ * @return int 成功返回写入字节数，否则失败
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 在指定位置读出，不依赖磁盘头；完成后磁盘头移到读出结尾(用于模拟下一次寻道)
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，必须为单次设备IO单位的整数倍
+ * @param offset 读出位置，注意要和设备IO单位对齐
+ * @return int 成功返回读出字节数，否则失败
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 带标志的定位写入
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，须为单次设备IO单位的整数倍
+ * @param offset 写入位置，注意要和设备IO单位对齐
+ * @param flags DDRIVER_WRITE_FUA：先下发plug队列，再绕过写缓存直接写入介质
+ * @return int 成功返回写入字节数，否则失败
+ */
+int ddriver_pwrite2(int fd, char *buf, size_t size, off_t offset, int flags);
+
+/**
+ * @brief 批量提交异步IO，立即返回，请求由驱动内的工作线程并发服务
+ *        (并发度即队列深度，由环境变量DDRIVER_QUEUE_DEPTH指定，默认4)；
+ *        设置DDRIVER_NCQ=1时模拟NCQ：只有一个磁头依次服务，每次从最早提交的
+ *        队列深度个请求中选取定位时间最短者(SPTF)，complete_ns - submit_ns为各请求的响应时间；
+ *        虚拟时钟下每个请求占用最早空闲的槽位(共队列深度个)，不同槽位上的请求相互重叠，
+ *        虚拟时钟取各槽位的最远点，因此队列深度越大模拟用时越短
+ * 
+ * @param fd ddriver设备handler
+ * @param ios 请求数组
+ * @param nr 请求数
+ * @return int 成功返回提交的请求数，否则失败
+ */
+int ddriver_submit(int fd, struct ddriver_io **ios, int nr);
+
+/**
+ * @brief 取回已完成的异步IO
+ * 
+ * @param fd ddriver设备handler
+ * @param min_nr 至少等待完成的请求数(超过在途请求数时按在途请求数计)
+ * @param max_nr 最多取回的请求数
+ * @param events 输出完成的请求
+ * @return int 取回的请求数
+ */
+int ddriver_getevents(int fd, int min_nr, int max_nr, struct ddriver_io **events);
+
+/**
+ * @brief 开始积攒写请求(plug)，之后的写只复制进驱动内的队列并立即返回，
+ *        覆盖队列中请求的读直接由队列返回
+ * 
+ * @param fd ddriver设备handler
+ * @return int 0成功，否则失败
+ */
+int ddriver_plug(int fd);
+
+/**
+ * @brief 结束积攒(unplug)，队列按偏移排序后以C-LOOK顺序下发，首尾相接的请求合并为一次写；
+ *        队列满、IOC_REQ_DEVICE_FLUSH与ddriver_close也会下发队列
+ * 
+ * @param fd ddriver设备handler
+ * @return int 0成功，否则失败
+ */
+int ddriver_unplug(int fd);
+
+/**
+ * @brief ddriver IO控制
+ * 
+ * @param fd ddriver设备handler
+ * @param cmd 命令号，查看ddriver_ctl_user，IOC_开头
+ * @param ret 返回值
+ * @return int 0成功，否则失败
+ */
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
+
+/**
+ * @brief 关闭ddriver设备
+ * 
+ * @param fd ddriver设备handler
+ * @return int 0成功，否则失败
+ */
 int ddriver_close(int fd);
 
 #endif /* _DDRIVER_H_ */
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include <stddef.h>
 #include "ddriver.h"
 #include "errno.h"
+#include <pthread.h>
 #include "types.h"
 
 #define NFS_MAGIC                  /* TODO: Define by yourself */
@@ -21,8 +22,11 @@
 *******************************************************************************/
 char* 			   nfs_get_fname(const char* path);
 int 			   nfs_calc_lvl(const char * path);
-int 			   nfs_driver_read(int offset, uint8_t *out_content, int size);
-int 			   nfs_driver_write(int offset, uint8_t *in_content, int size);
+uint8_t* 		   nfs_bounce_get(int size);
+int 			   nfs_driver_read(off_t offset, uint8_t *out_content, int size);
+int 			   nfs_driver_write(off_t offset, uint8_t *in_content, int size);
+int 			   nfs_driver_batch(struct ddriver_io *ios, int nr);
+int 			   nfs_driver_discard(off_t offset, off_t size);
 
 
 int 			   nfs_mount(struct custom_options options);
@@ -35,13 +39,26 @@ int 			   nfs_sync_inode(struct nfs_inode * inode);
 // int 			   sfs_drop_inode(struct sfs_inode * inode);
 struct nfs_inode*  nfs_read_inode(struct nfs_dentry * dentry, int ino);
 struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir);
+int 			   nfs_free_data_blk(struct nfs_inode * inode, int index);
 int nfs_inode_write(struct nfs_inode * inode, uint8_t *in_content, int size, int offset);
 int nfs_inode_read(struct nfs_inode * inode, uint8_t *out_content, int size, int offset);
+void nfs_inode_readahead(struct nfs_inode * inode, struct nfs_ra * ra, int offset, int size);
 
 
 
 struct nfs_dentry* nfs_lookup(const char * path, boolean * is_find, boolean* is_root);
 
+/******************************************************************************
+* SECTION: cache.c
+*******************************************************************************/
+int 			   nfs_cache_init(int cache_mb);
+int 			   nfs_cache_sync();
+int 			   nfs_cache_destroy();
+void 			   nfs_cache_invalidate(off_t offset, off_t size);
+int 			   nfs_blk_read(off_t offset, uint8_t *out_content, int size);
+int 			   nfs_blk_write(off_t offset, uint8_t *in_content, int size);
+void 			   nfs_cache_prefetch(int *blks, int nr);
+
 /******************************************************************************
 * SECTION: nfs.c
 *******************************************************************************/
@@ -63,7 +80,9 @@ int   			   nfs_rename(const char *, const char *);
 int   			   nfs_utimens(const char *, const struct timespec tv[2]);
 int   			   nfs_truncate(const char *, off_t);
 			
+int   			   nfs_fsync(const char *, int, struct fuse_file_info *);
 int   			   nfs_open(const char *, struct fuse_file_info *);
+int   			   nfs_release(const char *, struct fuse_file_info *);
 int   			   nfs_opendir(const char *, struct fuse_file_info *);
 
 int 				nfs_symlink(const char* , const char*);
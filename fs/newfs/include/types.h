@@ -38,6 +38,10 @@ typedef enum file_type {
 #define MAX_NAME_LEN    128
 #define NFS_MAX_INODE   1024            // 最大文件数
 #define INODE_DATA_BLK  6               //每个inode对应数据块索引数
+#define NFS_DEFAULT_CACHE_MB    4       // 块缓存默认容量(MB)，0为关闭
+#define NFS_NO_BLK              -1      // 缓存槽位空闲
+#define NFS_RA_MIN_BLKS         4       // 初始预读窗口(块)
+#define NFS_RA_MAX_BLKS         64      // 预读窗口上限(块)
 
 /******************************************************************************
 * SECTION: Macro Function
@@ -55,6 +59,9 @@ typedef enum file_type {
                                         memcpy(pnfs_dentry->name, _fname, strlen(_fname))
 
 #define NFS_INO_OFS(ino)                (super.inode_offset + ino * NFS_IO_SZ())
+#define NFS_DATA_OFS(dno)               ((off_t)super.data_offset + (off_t)(dno) * NFS_IO_SZ())
+#define NFS_BLK_OFS(blk)                ((off_t)(blk) * NFS_IO_SZ())
+#define NFS_CACHE_HASH(blk)             ((blk) & (bcache.nr_buckets - 1))
 
 #define NFS_IS_DIR(pinode)              (pinode->dentry->ftype == NFS_DIR)
 #define NFS_IS_FILE(pinode)              (pinode->dentry->ftype == NFS_FILE)
@@ -64,6 +71,7 @@ typedef enum file_type {
 *******************************************************************************/
 struct custom_options {
 	const char*        device;
+	int                cache_mb;          // 块缓存容量(MB)，--cache-mb=
 };
 
 struct nfs_super {
@@ -71,7 +79,7 @@ struct nfs_super {
     int                driver_fd;
 
     int                sz_io;              // NFS块大小
-    int                sz_disk;            // 磁盘块大小
+    off_t              sz_disk;            // 磁盘大小，可超过2GB
     int                sz_usage;
     int                max_ino;            // 最大支持文件数
     int                data_blks;          // 数据块数量
@@ -102,6 +110,44 @@ struct nfs_inode {
     char               target_path[MAX_NAME_LEN];/* store traget path when it is a symlink */
 };
 
+struct nfs_buf {
+    int                blk;                           /* NFS块号，NFS_NO_BLK为空闲 */
+    boolean            dirty;                         /* 与磁盘不一致，淘汰或同步时写回 */
+    boolean            ref;                           /* CLOCK引用位 */
+    boolean            io;                            /* 预读在途，完成前不可访问、不可淘汰 */
+    struct nfs_buf*    hash_next;                     /* 同一哈希桶的下一个 */
+    struct nfs_buf*    ra_next;                       /* 预读队列的下一个 */
+    uint8_t*           data;
+};
+
+struct nfs_cache {
+    int                nr_bufs;                       /* 0表示不使用缓存 */
+    int                nr_buckets;                    /* 2的幂 */
+    int                hand;                          /* CLOCK指针 */
+    struct nfs_buf*    bufs;
+    struct nfs_buf**   buckets;
+    uint8_t*           data;                          /* 所有缓存块的数据 */
+    pthread_mutex_t    lock;
+    int                nr_ra;                         /* 在途预读块数，不超过nr_bufs/2 */
+    boolean            ra_stop;
+    struct nfs_buf*    ra_head;                       /* 待读入的预读块，FIFO */
+    struct nfs_buf*    ra_tail;
+    pthread_t          ra_worker;
+    pthread_cond_t     ra_cond;                       /* 有新的预读请求 */
+    pthread_cond_t     io_cond;                       /* 有预读块完成 */
+};
+
+struct nfs_ra {
+    int                last;                          /* 上次读到的文件内块序号，-1为未读 */
+    int                end;                           /* 已发起预读的文件内块序号上界(不含) */
+    int                window;                        /* 当前预读窗口(块)，0为随机访问 */
+};
+
+struct nfs_bounce {
+    uint8_t*           data;                          /* 按NFS_IO_SZ()对齐 */
+    int                size;                          /* NFS_IO_SZ()的整数倍 */
+};
+
 struct nfs_dentry {
     char               name[MAX_NAME_LEN];
     uint32_t           ino;
@@ -0,0 +1,408 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super  super;
+
+struct nfs_cache bcache;                              /* 块缓存，所有元数据与数据IO经过这里 */
+
+/**
+ * @brief 查找缓存块
+ *
+ * @param blk NFS块号
+ * @return struct nfs_buf* 未命中返回NULL
+ */
+struct nfs_buf* nfs_cache_lookup(int blk) {
+    struct nfs_buf* buf = bcache.buckets[NFS_CACHE_HASH(blk)];
+    while (buf != NULL && buf->blk != blk) {
+        buf = buf->hash_next;
+    }
+    return buf;
+}
+
+/**
+ * @brief 把缓存块从哈希链上摘下，槽位变为空闲
+ *
+ * @param buf
+ */
+void nfs_cache_unhash(struct nfs_buf* buf) {
+    struct nfs_buf** cursor = &bcache.buckets[NFS_CACHE_HASH(buf->blk)];
+    while (*cursor != buf) {
+        cursor = &(*cursor)->hash_next;
+    }
+    *cursor        = buf->hash_next;
+    buf->hash_next = NULL;
+    buf->blk       = NFS_NO_BLK;
+    buf->dirty     = FALSE;
+}
+
+/**
+ * @brief 预读线程：依次读入预读队列中的块，完成后唤醒等待者；停止时先清空队列
+ *
+ * @param arg 未使用
+ * @return void*
+ */
+void* nfs_cache_ra_worker(void* arg) {
+    struct nfs_buf* buf;
+    int    ret;
+
+    pthread_mutex_lock(&bcache.lock);
+    while (1)
+    {
+        while (bcache.ra_head == NULL && !bcache.ra_stop) {
+            pthread_cond_wait(&bcache.ra_cond, &bcache.lock);
+        }
+        if (bcache.ra_head == NULL) {
+            break;
+        }
+        buf = bcache.ra_head;
+        bcache.ra_head = buf->ra_next;
+        if (bcache.ra_head == NULL) {
+            bcache.ra_tail = NULL;
+        }
+        buf->ra_next = NULL;
+
+        // 在途块不会被访问或淘汰，读盘时无需持锁
+        pthread_mutex_unlock(&bcache.lock);
+        ret = ddriver_pread(NFS_DRIVER(), (char *)buf->data, NFS_IO_SZ(), NFS_BLK_OFS(buf->blk));
+        pthread_mutex_lock(&bcache.lock);
+
+        buf->io = FALSE;
+        bcache.nr_ra--;
+        if (ret < 0) {
+            nfs_cache_unhash(buf);
+        }
+        pthread_cond_broadcast(&bcache.io_cond);
+    }
+    pthread_mutex_unlock(&bcache.lock);
+    return NULL;
+}
+
+/**
+ * @brief 初始化块缓存，容量按NFS块取整，哈希桶数取不小于块数的2的幂
+ *
+ * @param cache_mb 容量(MB)，0为不使用缓存
+ * @return int
+ */
+int nfs_cache_init(int cache_mb) {
+    int i;
+
+    memset(&bcache, 0, sizeof(struct nfs_cache));
+    pthread_mutex_init(&bcache.lock, NULL);
+    pthread_cond_init(&bcache.ra_cond, NULL);
+    pthread_cond_init(&bcache.io_cond, NULL);
+    if (cache_mb <= 0) {
+        return NFS_ERROR_NONE;
+    }
+
+    bcache.nr_bufs    = (int)((long long)cache_mb * 1024 * 1024 / NFS_IO_SZ());
+    bcache.nr_buckets = 1;
+    while (bcache.nr_buckets < bcache.nr_bufs) {
+        bcache.nr_buckets <<= 1;
+    }
+    bcache.bufs    = (struct nfs_buf*)calloc(bcache.nr_bufs, sizeof(struct nfs_buf));
+    bcache.buckets = (struct nfs_buf**)calloc(bcache.nr_buckets, sizeof(struct nfs_buf*));
+    bcache.data    = (uint8_t*)malloc(NFS_BLKS_SZ((long long)bcache.nr_bufs));
+    if (bcache.bufs == NULL || bcache.buckets == NULL || bcache.data == NULL) {
+        free(bcache.bufs);
+        free(bcache.buckets);
+        free(bcache.data);
+        bcache.nr_bufs = 0;
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < bcache.nr_bufs; i++) {
+        bcache.bufs[i].blk  = NFS_NO_BLK;
+        bcache.bufs[i].data = bcache.data + NFS_BLKS_SZ((long long)i);
+    }
+    if (pthread_create(&bcache.ra_worker, NULL, nfs_cache_ra_worker, NULL) != 0) {
+        free(bcache.bufs);
+        free(bcache.buckets);
+        free(bcache.data);
+        bcache.nr_bufs = 0;
+        return -NFS_ERROR_NOSPACE;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 写回一个脏块
+ *
+ * @param buf
+ * @return int
+ */
+int nfs_cache_writeback(struct nfs_buf* buf) {
+    if (nfs_driver_write(NFS_BLK_OFS(buf->blk), buf->data, NFS_IO_SZ()) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    buf->dirty = FALSE;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief CLOCK淘汰：跳过预读在途的块，跳过并清除引用位为1的块，取第一个引用位为0的块，脏块先写回
+ *
+ * @return struct nfs_buf* 空闲槽位，写回失败返回NULL
+ */
+struct nfs_buf* nfs_cache_evict() {
+    struct nfs_buf* buf;
+
+    while (1)
+    {
+        buf = &bcache.bufs[bcache.hand];
+        bcache.hand = (bcache.hand + 1) % bcache.nr_bufs;
+        if (buf->blk == NFS_NO_BLK) {
+            return buf;
+        }
+        if (buf->io) {
+            continue;
+        }
+        if (buf->ref) {
+            buf->ref = FALSE;
+            continue;
+        }
+        if (buf->dirty && nfs_cache_writeback(buf) != NFS_ERROR_NONE) {
+            return NULL;
+        }
+        nfs_cache_unhash(buf);
+        return buf;
+    }
+}
+
+/**
+ * @brief 取得块blk的缓存，命中预读在途的块时等待其完成，未命中时淘汰一块后载入
+ *
+ * @param blk NFS块号
+ * @param fill 未命中时是否从磁盘读出，整块覆盖写时无需读出
+ * @return struct nfs_buf* 失败返回NULL
+ */
+struct nfs_buf* nfs_cache_get(int blk, boolean fill) {
+    struct nfs_buf* buf;
+
+    while ((buf = nfs_cache_lookup(blk)) != NULL && buf->io) {
+        pthread_cond_wait(&bcache.io_cond, &bcache.lock);
+    }
+    if (buf != NULL) {
+        buf->ref = TRUE;
+        return buf;
+    }
+    buf = nfs_cache_evict();
+    if (buf == NULL) {
+        return NULL;
+    }
+    if (fill && ddriver_pread(NFS_DRIVER(), (char *)buf->data, NFS_IO_SZ(), NFS_BLK_OFS(blk)) < 0) {
+        return NULL;
+    }
+    buf->blk       = blk;
+    buf->ref       = TRUE;
+    buf->dirty     = FALSE;
+    buf->hash_next = bcache.buckets[NFS_CACHE_HASH(blk)];
+    bcache.buckets[NFS_CACHE_HASH(blk)] = buf;
+    return buf;
+}
+
+/**
+ * @brief 经缓存读出任意字节区间
+ *
+ * @param offset
+ * @param out_content
+ * @param size
+ * @return int
+ */
+int nfs_blk_read(off_t offset, uint8_t *out_content, int size) {
+    struct nfs_buf* buf;
+    int    blk     = offset / NFS_IO_SZ();
+    int    off_blk = offset % NFS_IO_SZ();
+    int    size_read;
+
+    if (bcache.nr_bufs == 0) {
+        return nfs_driver_read(offset, out_content, size);
+    }
+    pthread_mutex_lock(&bcache.lock);
+    for (; size > 0; blk++, off_blk = 0, out_content += size_read, size -= size_read) {
+        size_read = NFS_IO_SZ() - off_blk > size ? size : NFS_IO_SZ() - off_blk;
+        buf = nfs_cache_get(blk, TRUE);
+        if (buf == NULL) {
+            pthread_mutex_unlock(&bcache.lock);
+            return -NFS_ERROR_IO;
+        }
+        memcpy(out_content, buf->data + off_blk, size_read);
+    }
+    pthread_mutex_unlock(&bcache.lock);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 经缓存写入任意字节区间，只标记脏块，不访问磁盘
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int nfs_blk_write(off_t offset, uint8_t *in_content, int size) {
+    struct nfs_buf* buf;
+    int    blk     = offset / NFS_IO_SZ();
+    int    off_blk = offset % NFS_IO_SZ();
+    int    size_write;
+
+    if (bcache.nr_bufs == 0) {
+        return nfs_driver_write(offset, in_content, size);
+    }
+    pthread_mutex_lock(&bcache.lock);
+    for (; size > 0; blk++, off_blk = 0, in_content += size_write, size -= size_write) {
+        size_write = NFS_IO_SZ() - off_blk > size ? size : NFS_IO_SZ() - off_blk;
+        buf = nfs_cache_get(blk, size_write != NFS_IO_SZ());
+        if (buf == NULL) {
+            pthread_mutex_unlock(&bcache.lock);
+            return -NFS_ERROR_IO;
+        }
+        memcpy(buf->data + off_blk, in_content, size_write);
+        buf->dirty = TRUE;
+    }
+    pthread_mutex_unlock(&bcache.lock);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 发起异步预读：为不在缓存中的块占好槽位后交给预读线程，立即返回
+ *
+ * @param blks NFS块号数组
+ * @param nr
+ */
+void nfs_cache_prefetch(int *blks, int nr) {
+    struct nfs_buf* buf;
+    int    i;
+
+    if (bcache.nr_bufs == 0 || nr <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&bcache.lock);
+    for (i = 0; i < nr && bcache.nr_ra < bcache.nr_bufs / 2; i++) {
+        if (nfs_cache_lookup(blks[i]) != NULL) {
+            continue;
+        }
+        buf = nfs_cache_evict();
+        if (buf == NULL) {
+            break;
+        }
+        buf->blk       = blks[i];
+        buf->ref       = TRUE;
+        buf->dirty     = FALSE;
+        buf->io        = TRUE;
+        buf->hash_next = bcache.buckets[NFS_CACHE_HASH(blks[i])];
+        bcache.buckets[NFS_CACHE_HASH(blks[i])] = buf;
+        if (bcache.ra_tail == NULL) {
+            bcache.ra_head = buf;
+        }
+        else {
+            bcache.ra_tail->ra_next = buf;
+        }
+        bcache.ra_tail = buf;
+        bcache.nr_ra++;
+    }
+    pthread_cond_signal(&bcache.ra_cond);
+    pthread_mutex_unlock(&bcache.lock);
+}
+
+int nfs_buf_cmp(const void *a, const void *b) {
+    int lhs = (*(struct nfs_buf* const *)a)->blk;
+    int rhs = (*(struct nfs_buf* const *)b)->blk;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/**
+ * @brief 按块号顺序写回全部脏块
+ *
+ * @return int
+ */
+int nfs_cache_sync() {
+    struct nfs_buf** dirty;
+    int    i, nr = 0, ret = NFS_ERROR_NONE;
+
+    if (bcache.nr_bufs == 0) {
+        return NFS_ERROR_NONE;
+    }
+    dirty = (struct nfs_buf**)malloc(sizeof(struct nfs_buf*) * bcache.nr_bufs);
+    if (dirty == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    pthread_mutex_lock(&bcache.lock);
+    for (i = 0; i < bcache.nr_bufs; i++) {
+        if (bcache.bufs[i].blk != NFS_NO_BLK && bcache.bufs[i].dirty) {
+            dirty[nr++] = &bcache.bufs[i];
+        }
+    }
+    qsort(dirty, nr, sizeof(struct nfs_buf*), nfs_buf_cmp);
+    for (i = 0; i < nr; i++) {
+        if (nfs_cache_writeback(dirty[i]) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+        }
+    }
+    free(dirty);
+    pthread_mutex_unlock(&bcache.lock);
+    return ret;
+}
+
+/**
+ * @brief 停止预读线程，写回全部脏块并释放缓存
+ *
+ * @return int
+ */
+int nfs_cache_destroy() {
+    int ret;
+
+    if (bcache.nr_bufs != 0) {
+        pthread_mutex_lock(&bcache.lock);
+        bcache.ra_stop = TRUE;
+        pthread_cond_signal(&bcache.ra_cond);
+        pthread_mutex_unlock(&bcache.lock);
+        pthread_join(bcache.ra_worker, NULL);
+    }
+    ret = nfs_cache_sync();
+
+    free(bcache.bufs);
+    free(bcache.buckets);
+    free(bcache.data);
+    bcache.nr_bufs = 0;
+    pthread_mutex_destroy(&bcache.lock);
+    pthread_cond_destroy(&bcache.ra_cond);
+    pthread_cond_destroy(&bcache.io_cond);
+    return ret;
+}
+
+/**
+ * @brief 丢弃区间内的缓存块(不写回)，用于磁盘区域被丢弃之后；先等待在途预读全部完成
+ *
+ * @param offset
+ * @param size
+ */
+void nfs_cache_invalidate(off_t offset, off_t size) {
+    struct nfs_buf* buf;
+    off_t  blk;
+    int    i;
+
+    if (bcache.nr_bufs == 0) {
+        return;
+    }
+    pthread_mutex_lock(&bcache.lock);
+    while (bcache.nr_ra > 0) {
+        pthread_cond_wait(&bcache.io_cond, &bcache.lock);
+    }
+    if (size / NFS_IO_SZ() > bcache.nr_bufs) {        /* 区间大于缓存时逐槽位检查 */
+        for (i = 0; i < bcache.nr_bufs; i++) {
+            buf = &bcache.bufs[i];
+            if (buf->blk != NFS_NO_BLK && NFS_BLK_OFS(buf->blk) >= offset
+                && NFS_BLK_OFS(buf->blk) + NFS_IO_SZ() <= offset + size) {
+                nfs_cache_unhash(buf);
+            }
+        }
+    }
+    else {
+        for (blk = NFS_ROUND_UP(offset, NFS_IO_SZ()) / NFS_IO_SZ();
+             NFS_BLK_OFS(blk + 1) <= offset + size; blk++) {
+            buf = nfs_cache_lookup(blk);
+            if (buf != NULL) {
+                nfs_cache_unhash(buf);
+            }
+        }
+    }
+    pthread_mutex_unlock(&bcache.lock);
+}
@@ -10,6 +10,7 @@
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--cache-mb=%d", cache_mb),
 	FUSE_OPT_END
 };
 
@@ -30,12 +31,14 @@ static struct fuse_operations operations = {
 	.utimens = nfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
 	.symlink = nfs_symlink,							  /* 软链接 */
 	.readlink = nfs_readlink,
+	.fsync = nfs_fsync,								  /* 写回块缓存 */
 	.truncate = NULL,						  		 /* 改变文件大小 */
 	.unlink = NULL,							  		 /* 删除文件 */
 	.rmdir	= NULL,							  		 /* 删除目录， rm -r */
 	.rename = NULL,							  		 /* 重命名，mv */
 
-	.open = NULL,							
+	.open = nfs_open,								  /* 建立预读状态 */
+	.release = nfs_release,
 	.opendir = NULL,
 	.access = NULL
 };
@@ -313,6 +316,9 @@ int nfs_read(const char* path, char* buf, size_t size, off_t offset,
 	if(nfs_inode_read(inode, buf, size, offset) != NFS_ERROR_NONE)
 		return -NFS_ERROR_UNSUPPORTED;
 
+	if (fi != NULL && fi->fh != 0) {
+		nfs_inode_readahead(inode, (struct nfs_ra*)(uintptr_t)fi->fh, offset, size);
+	}
 	return size;			   
 }
 
@@ -372,6 +378,28 @@ int nfs_readlink (const char *path, char *buf, size_t size){
 	return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 同步文件，写回inode与块缓存中的脏块
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 可忽略
+ * @param fi 可忽略
+ * @return int 0成功，否则失败
+ */
+int nfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
+
+	(void)datasync;
+	if (is_find == FALSE) {
+		return -NFS_ERROR_NOTFOUND;
+	}
+	if (nfs_sync_inode(dentry->inode) != NFS_ERROR_NONE) {
+		return -NFS_ERROR_IO;
+	}
+	return nfs_cache_sync();
+}
+
 /**
  * @brief 删除文件
  * 
@@ -421,8 +449,27 @@ int nfs_rename(const char* from, const char* to) {
  * @return int 0成功，否则失败
  */
 int nfs_open(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	struct nfs_ra* ra = (struct nfs_ra*)calloc(1, sizeof(struct nfs_ra));
+
+	if (ra == NULL) {
+		return -NFS_ERROR_NOSPACE;
+	}
+	ra->last = -1;
+	fi->fh   = (uint64_t)(uintptr_t)ra;
+	return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭文件，释放nfs_open建立的预读状态
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int nfs_release(const char* path, struct fuse_file_info* fi) {
+	free((void*)(uintptr_t)fi->fh);
+	fi->fh = 0;
+	return NFS_ERROR_NONE;
 }
 
 /**
@@ -475,6 +522,7 @@ int main(int argc, char **argv)
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	nfs_options.device = strdup("/home/students/200110530/ddriver");
+	nfs_options.cache_mb = NFS_DEFAULT_CACHE_MB;
 
 	if (fuse_opt_parse(&args, &nfs_options, option_spec, NULL) == -1)
 		return -1;
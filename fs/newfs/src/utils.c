@@ -2,6 +2,9 @@
 
 extern struct nfs_super  super; 
 
+pthread_key_t   nfs_bounce_key;                       /* 每线程一个bounce缓冲区 */
+pthread_once_t  nfs_bounce_once = PTHREAD_ONCE_INIT;
+
 /**
  * @brief 获取文件名
  * 
@@ -38,60 +41,174 @@ int nfs_calc_lvl(const char * path) {
     return lvl;
 }
 
+void nfs_bounce_free(void *arg) {
+    struct nfs_bounce* bounce = (struct nfs_bounce*)arg;
+    free(bounce->data);
+    free(bounce);
+}
+
+void nfs_bounce_key_init() {
+    pthread_key_create(&nfs_bounce_key, nfs_bounce_free);
+}
+
+/**
+ * @brief 取当前线程的bounce缓冲区，不足size时按NFS_IO_SZ()取整扩大，线程退出时释放
+ * 
+ * @param size 
+ * @return uint8_t* 失败返回NULL
+ */
+uint8_t* nfs_bounce_get(int size) {
+    struct nfs_bounce* bounce;
+    void*              data;
+
+    pthread_once(&nfs_bounce_once, nfs_bounce_key_init);
+    bounce = (struct nfs_bounce*)pthread_getspecific(nfs_bounce_key);
+    if (bounce == NULL) {
+        bounce = (struct nfs_bounce*)calloc(1, sizeof(struct nfs_bounce));
+        if (bounce == NULL) {
+            return NULL;
+        }
+        pthread_setspecific(nfs_bounce_key, bounce);
+    }
+    if (bounce->size < size) {
+        size = NFS_ROUND_UP(size, NFS_IO_SZ());
+        if (posix_memalign(&data, NFS_IO_SZ(), size) != 0) {
+            return NULL;
+        }
+        free(bounce->data);
+        bounce->data = (uint8_t*)data;
+        bounce->size = size;
+    }
+    return bounce->data;
+}
+
 /**
- * @brief 驱动读
+ * @brief 驱动读，已对齐时直接读入调用者缓冲区
  * 
  * @param offset 
  * @param out_content 
  * @param size 
  * @return int 
  */
-int nfs_driver_read(int offset, uint8_t *out_content, int size) {
+int nfs_driver_read(off_t offset, uint8_t *out_content, int size) {
     // 保证每次从驱动中读出完整一块
-    int      offset_aligned = NFS_ROUND_DOWN(offset, DRIVER_IO_SZ());
+    off_t    offset_aligned = NFS_ROUND_DOWN(offset, DRIVER_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = NFS_ROUND_UP((size + bias), DRIVER_IO_SZ());
+    uint8_t* temp_content;
 
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
+    if (bias == 0 && size == size_aligned) {
+        temp_content = out_content;
+    }
+    else if ((temp_content = nfs_bounce_get(size_aligned)) == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
 
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        ddriver_read(NFS_DRIVER(), cur, DRIVER_IO_SZ());
-        cur          += DRIVER_IO_SZ();
-        size_aligned -= DRIVER_IO_SZ();   
+    // 一次读出全部对齐块
+    if (ddriver_pread(NFS_DRIVER(), (char *)temp_content, size_aligned, offset_aligned) < 0) {
+        return -NFS_ERROR_IO;
+    }
+    if (temp_content != out_content) {
+        memcpy(out_content, temp_content + bias, size);
     }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
     return NFS_ERROR_NONE;
 }
 /**
- * @brief 驱动写
+ * @brief 驱动写，只预读未被完整覆盖的首尾两个驱动块，完全对齐时直接写入
  * 
  * @param offset 
  * @param in_content 
  * @param size 
  * @return int 
  */
-int nfs_driver_write(int offset, uint8_t *in_content, int size) {
-    int      offset_aligned = NFS_ROUND_DOWN(offset, DRIVER_IO_SZ());
+int nfs_driver_write(off_t offset, uint8_t *in_content, int size) {
+    off_t    offset_aligned = NFS_ROUND_DOWN(offset, DRIVER_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = NFS_ROUND_UP((size + bias), DRIVER_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    nfs_driver_read(offset_aligned, temp_content, size_aligned);
+    int      tail           = size_aligned - DRIVER_IO_SZ();
+    uint8_t* temp_content;
+
+    if (bias == 0 && size == size_aligned) {
+        if (ddriver_pwrite(NFS_DRIVER(), (char *)in_content, size, offset) < 0) {
+            return -NFS_ERROR_IO;
+        }
+        return NFS_ERROR_NONE;
+    }
+
+    if ((temp_content = nfs_bounce_get(size_aligned)) == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    // 首块部分覆盖
+    if (bias != 0 && ddriver_pread(NFS_DRIVER(), (char *)temp_content, 
+                                   DRIVER_IO_SZ(), offset_aligned) < 0) {
+        return -NFS_ERROR_IO;
+    }
+    // 尾块部分覆盖，且与已读出的首块不是同一块
+    if ((bias + size) % DRIVER_IO_SZ() != 0 && !(bias != 0 && tail == 0)
+        && ddriver_pread(NFS_DRIVER(), (char *)temp_content + tail, 
+                         DRIVER_IO_SZ(), offset_aligned + tail) < 0) {
+        return -NFS_ERROR_IO;
+    }
     memcpy(temp_content + bias, in_content, size);
 
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        ddriver_write(NFS_DRIVER(), cur, DRIVER_IO_SZ());
-        cur          += DRIVER_IO_SZ();
-        size_aligned -= DRIVER_IO_SZ();   
+    // 一次写回全部对齐块
+    if (ddriver_pwrite(NFS_DRIVER(), (char *)temp_content, size_aligned, offset_aligned) < 0) {
+        return -NFS_ERROR_IO;
     }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 批量异步提交对齐的驱动IO并等待全部完成，用于重叠互不相关的元数据读写
+ * 
+ * @param ios 请求数组，offset与size须与DRIVER_IO_SZ()对齐
+ * @param nr 
+ * @return int 
+ */
+int nfs_driver_batch(struct ddriver_io *ios, int nr) {
+    struct ddriver_io* reqs[nr];
+    int              i, n, done = 0, ret = NFS_ERROR_NONE;
+
+    for (i = 0; i < nr; i++) {
+        reqs[i] = &ios[i];
+    }
+    if (ddriver_submit(NFS_DRIVER(), reqs, nr) != nr) {
+        return -NFS_ERROR_IO;
+    }
+    while (done < nr) {
+        n = ddriver_getevents(NFS_DRIVER(), nr - done, nr - done, reqs);
+        if (n <= 0) {                                 /* 出错，或在途请求已被取走，不会再有完成 */
+            return -NFS_ERROR_IO;
+        }
+        done += n;
+    }
+    for (i = 0; i < nr; i++) {
+        if (ios[i].res < 0) {
+            ret = -NFS_ERROR_IO;
+        }
+    }
+    return ret;
+}
 
-    free(temp_content);
+/**
+ * @brief 通知驱动丢弃一段区域，只丢弃其中完整的驱动IO单位；区间内的缓存块一并丢弃
+ * 
+ * @param offset 
+ * @param size 
+ * @return int 
+ */
+int nfs_driver_discard(off_t offset, off_t size) {
+    struct ddriver_discard range;
+
+    nfs_cache_invalidate(offset, size);
+    range.offset = NFS_ROUND_UP(offset, DRIVER_IO_SZ());
+    range.len    = NFS_ROUND_DOWN((offset + size), DRIVER_IO_SZ()) - range.offset;
+    if (range.len <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    if (ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_DISCARD, &range) < 0) {
+        return -NFS_ERROR_IO;
+    }
     return NFS_ERROR_NONE;
 }
 
@@ -178,6 +295,26 @@ int nfs_alloc_data_blk(struct nfs_inode* inode, int index) {
     return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 释放inode第index个数据块，清除位图并丢弃其内容
+ * 
+ * @param inode 
+ * @param index 
+ * @return int 
+ */
+int nfs_free_data_blk(struct nfs_inode* inode, int index) {
+    int dno;
+
+    if (index >= INODE_DATA_BLK || inode->block_pointer[index] == NO_DATA_BLK_IDX)
+        return NFS_ERROR_NONE;
+
+    dno = inode->block_pointer[index];
+    super.map_data[dno / UINT8_BITS] &= ~(0x1 << (dno % UINT8_BITS));
+    inode->block_pointer[index] = NO_DATA_BLK_IDX;
+
+    return nfs_driver_discard(NFS_DATA_OFS(dno), NFS_IO_SZ());
+}
+
 /**
  * @brief 向indoe写入
  * 
@@ -212,8 +349,9 @@ int nfs_inode_write(struct nfs_inode * inode, uint8_t *in_content, int size, int
 
         // 本次写入的数据大小
         size_write = (NFS_IO_SZ()-off_blk) > size_residual ? size_residual : (NFS_IO_SZ()-off_blk);
-        nfs_driver_write(super.data_offset+(inode->block_pointer[index])*NFS_IO_SZ()+off_blk,
-                            in_content, size_write);
+        if (nfs_blk_write(NFS_DATA_OFS(inode->block_pointer[index]) + off_blk,
+                          in_content, size_write) != NFS_ERROR_NONE)
+            return -NFS_ERROR_IO;
 
         // 一个数据块装不下，准备写入下一个数据块 
         index++, off_blk = 0, in_content += size_write;
@@ -259,8 +397,9 @@ int nfs_inode_read(struct nfs_inode * inode, uint8_t *out_content, int size, int
 
         // 本次读出的数据大小
         size_read = (NFS_IO_SZ()-off_blk) > size_residual ? size_residual : (NFS_IO_SZ()-off_blk);
-        nfs_driver_read(super.data_offset+(inode->block_pointer[index])*NFS_IO_SZ()+off_blk,
-                            out_content, size_read);
+        if (nfs_blk_read(NFS_DATA_OFS(inode->block_pointer[index]) + off_blk,
+                         out_content, size_read) != NFS_ERROR_NONE)
+            return -NFS_ERROR_IO;
 
         // 一个数据块装不下，准备写入下一个数据块 
         index++, off_blk = 0, out_content += size_read;
@@ -269,6 +408,53 @@ int nfs_inode_read(struct nfs_inode * inode, uint8_t *out_content, int size, int
     return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 顺序读检测与预读：本次读紧接上次时窗口翻倍(首次取NFS_RA_MIN_BLKS与两倍请求块数的较大者)，
+ * 并把窗口内尚未发起的数据块交给块缓存异步读入；随机访问时窗口清零
+ * 
+ * @param inode 
+ * @param ra 本次打开的预读状态
+ * @param offset 本次读的文件内偏移
+ * @param size 本次读的大小
+ */
+void nfs_inode_readahead(struct nfs_inode * inode, struct nfs_ra * ra, int offset, int size) {
+    int first = offset / NFS_IO_SZ();
+    int last  = (offset + size - 1) / NFS_IO_SZ();
+    int blks[NFS_RA_MAX_BLKS];
+    int index, stop, nr = 0;
+
+    if (size <= 0) {
+        return;
+    }
+    if (first == ra->last || first == ra->last + 1) {
+        if (ra->window == 0) {
+            ra->window = 2 * (last - first + 1) > NFS_RA_MIN_BLKS ? 2 * (last - first + 1) : NFS_RA_MIN_BLKS;
+        }
+        else {
+            ra->window *= 2;
+        }
+        ra->window = ra->window > NFS_RA_MAX_BLKS ? NFS_RA_MAX_BLKS : ra->window;
+    }
+    else {
+        ra->window = 0;
+        ra->end    = 0;
+    }
+    ra->last = last;
+    if (ra->window == 0) {
+        return;
+    }
+
+    index = ra->end > last + 1 ? ra->end : last + 1;
+    stop  = last + 1 + ra->window > INODE_DATA_BLK ? INODE_DATA_BLK : last + 1 + ra->window;
+    for (; index < stop; index++) {
+        if (inode->block_pointer[index] != NO_DATA_BLK_IDX) {
+            blks[nr++] = NFS_DATA_OFS(inode->block_pointer[index]) / NFS_IO_SZ();
+        }
+    }
+    ra->end = stop > ra->end ? stop : ra->end;
+    nfs_cache_prefetch(blks, nr);
+}
+
 
 /**
  * @brief 分配一个inode，占用位图
@@ -360,7 +546,7 @@ int nfs_sync_inode(struct nfs_inode * inode) {
         }
     }
     else if (NFS_IS_FILE(inode)) {
-        // 不用管，对inode写入时是直接写入磁盘，只需要保证前面将数据块指针复制正确即可
+        // 不用管，数据已写入块缓存，只需要保证前面将数据块指针复制正确即可
     }
 
     /* Cycle 2: 写 INODE */
@@ -373,7 +559,7 @@ int nfs_sync_inode(struct nfs_inode * inode) {
     // 将数据块指针写回disk
     for(int i=0;i<INODE_DATA_BLK;i++)
             inode_d.block_pointer[i] = inode->block_pointer[i];
-    if (nfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
+    if (nfs_blk_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
                      sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE) {
         return -NFS_ERROR_IO;
     }
@@ -394,7 +580,7 @@ struct nfs_inode* nfs_read_inode(struct nfs_dentry * dentry, int ino) {
     struct nfs_dentry* sub_dentry;
     struct nfs_dentry_d dentry_d;
     int    dir_cnt = 0, i;
-    if (nfs_driver_read(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
+    if (nfs_blk_read(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
                         sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE) {
         return NULL;                    
     }
@@ -524,6 +710,7 @@ int nfs_mount(struct custom_options options){
     int                 ret = NFS_ERROR_NONE;
     int                 driver_fd;
     int                 driver_io_sz;
+    long long           driver_disk_sz;
     struct nfs_super_d  nfs_super_d; 
     struct nfs_dentry*  root_dentry;
     struct nfs_inode*   root_inode;
@@ -532,6 +719,7 @@ int nfs_mount(struct custom_options options){
     int                 map_inode_blks;
     int                 inode_blks;
     int                 map_data_blks;
+    int                 data_blks;
     
     int                 super_blks;
     boolean             is_init = FALSE;
@@ -545,16 +733,21 @@ int nfs_mount(struct custom_options options){
     }
 
     super.driver_fd = driver_fd;
-    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &super.sz_disk);
+    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_SIZE64, &driver_disk_sz);
     ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &driver_io_sz);
 
     // 1024B
     super.sz_io = driver_io_sz*2;
+    super.sz_disk = driver_disk_sz;
     
     root_dentry = new_dentry("/", NFS_DIR);
 
-    if (nfs_driver_read(NFS_SUPER_OFS, (uint8_t *)(&nfs_super_d), 
+    if (nfs_cache_init(options.cache_mb) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (nfs_blk_read(NFS_SUPER_OFS, (uint8_t *)(&nfs_super_d), 
                         sizeof(struct nfs_super_d)) != NFS_ERROR_NONE) {
+        nfs_cache_destroy();                          /* 停止预读线程并释放缓存 */
         return -NFS_ERROR_IO;
     }   
                                                       /* 读取super */
@@ -572,8 +765,10 @@ int nfs_mount(struct custom_options options){
         // inode 块数 ····· 1024
         inode_blks = NFS_MAX_INODE;
 
-        // data_map 块数 ····· 
-        map_data_blks = 1;
+        // data_map 块数 ····· 按剩余块数计算，保证大盘上位图能覆盖全部数据块
+        data_blks = blk_num - super_blks - map_inode_blks - inode_blks;
+        map_data_blks = NFS_ROUND_UP(NFS_ROUND_UP(data_blks, 8)/8, NFS_IO_SZ()) 
+                                    / NFS_IO_SZ();
 
         // data 块数  
         nfs_super_d.data_blks = blk_num - super_blks - map_inode_blks - inode_blks - map_data_blks;
@@ -602,17 +797,23 @@ int nfs_mount(struct custom_options options){
     super.inode_offset =  nfs_super_d.map_data_offset + NFS_BLKS_SZ(nfs_super_d.map_data_blks);
     super.data_offset =  super.inode_offset + NFS_BLKS_SZ(nfs_super_d.max_ino);
 
-    // 读取出位图
-    if (nfs_driver_read(nfs_super_d.map_inode_offset, (uint8_t *)(super.map_inode), 
-                        NFS_BLKS_SZ(nfs_super_d.map_inode_blks)) != NFS_ERROR_NONE) {
-        return -NFS_ERROR_IO;
-    }
-    if (nfs_driver_read(nfs_super_d.map_data_offset, (uint8_t *)(super.map_data), 
-                        NFS_BLKS_SZ(nfs_super_d.map_data_blks)) != NFS_ERROR_NONE) {
+    // 读取出位图，两张位图一次批量提交
+    struct ddriver_io map_ios[2] = {
+        { .op = DDRIVER_OP_READ, .buf = (char *)super.map_inode, 
+          .size = NFS_BLKS_SZ(nfs_super_d.map_inode_blks), .offset = nfs_super_d.map_inode_offset },
+        { .op = DDRIVER_OP_READ, .buf = (char *)super.map_data, 
+          .size = NFS_BLKS_SZ(nfs_super_d.map_data_blks),  .offset = nfs_super_d.map_data_offset },
+    };
+    if (nfs_driver_batch(map_ios, 2) != NFS_ERROR_NONE) {
+        nfs_cache_destroy();
+        free(super.map_inode);
+        free(super.map_data);
         return -NFS_ERROR_IO;
     }
 
     if (is_init) {                                    /* 分配根节点 */
+        nfs_driver_discard(super.data_offset,         /* 格式化时丢弃整个数据区，镜像保持稀疏 */
+                           NFS_BLKS_SZ((off_t)super.data_blks));
         root_inode = nfs_alloc_inode(root_dentry);
         nfs_sync_inode(root_inode);
     }
@@ -633,11 +834,13 @@ int nfs_mount(struct custom_options options){
  */
 int nfs_umount() {
     struct nfs_super_d  nfs_super_d; 
+    int                 ret = NFS_ERROR_NONE;
 
     if (!super.is_mounted) {
         return NFS_ERROR_NONE;
     }
 
+    ddriver_plug(NFS_DRIVER());                   /* 刷写期间的写由驱动排序合并 */
     nfs_sync_inode(super.root_dentry->inode);     /* 从根节点向下刷写节点 */
                                                     
     nfs_super_d.magic_num           = NFS_MAGIC_NUM;
@@ -649,24 +852,32 @@ int nfs_umount() {
     nfs_super_d.max_ino    = super.max_ino;
     nfs_super_d.data_blks = super.data_blks;
 
-    if (nfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&nfs_super_d, 
+    if (nfs_blk_write(NFS_SUPER_OFS, (uint8_t *)&nfs_super_d, 
                      sizeof(struct nfs_super_d)) != NFS_ERROR_NONE) {
-        return -NFS_ERROR_IO;
+        ret = -NFS_ERROR_IO;
     }
 
-    if (nfs_driver_write(nfs_super_d.map_inode_offset, (uint8_t *)(super.map_inode), 
-                         NFS_BLKS_SZ(nfs_super_d.map_inode_blks)) != NFS_ERROR_NONE) {
-        return -NFS_ERROR_IO;
+    // 位图与块边界对齐，无需读改写，一次批量提交
+    struct ddriver_io map_ios[2] = {
+        { .op = DDRIVER_OP_WRITE, .buf = (char *)super.map_inode, 
+          .size = NFS_BLKS_SZ(nfs_super_d.map_inode_blks), .offset = nfs_super_d.map_inode_offset },
+        { .op = DDRIVER_OP_WRITE, .buf = (char *)super.map_data, 
+          .size = NFS_BLKS_SZ(nfs_super_d.map_data_blks),  .offset = nfs_super_d.map_data_offset },
+    };
+    if (nfs_driver_batch(map_ios, 2) != NFS_ERROR_NONE) {
+        ret = -NFS_ERROR_IO;
     }
-
-    if (nfs_driver_write(nfs_super_d.map_data_offset, (uint8_t *)(super.map_data), 
-                         NFS_BLKS_SZ(nfs_super_d.map_data_blks)) != NFS_ERROR_NONE) {
-        return -NFS_ERROR_IO;
+    if (nfs_cache_destroy() != NFS_ERROR_NONE) {  /* 写回全部脏块，随plug一起排序下发 */
+        ret = -NFS_ERROR_IO;
+    }
+    // 任一步出错也要unplug，否则已排队的写永远不会下发
+    if (ddriver_unplug(NFS_DRIVER()) < 0) {
+        ret = -NFS_ERROR_IO;
     }
 
     free(super.map_inode);
     free(super.map_data);
     ddriver_close(NFS_DRIVER());
 
-    return NFS_ERROR_NONE;
+    return ret;
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - block cache"
+
+GOLDEN=$(for i in $(seq 1 60); do echo -n "line $i of a file that spans several cached blocks. "; done)
+
+function check_cached_read () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! echo -n "$_PARAM" | tee "${MNTPOINT}"/file_c > /dev/null; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/file_c失败"
+        return 1
+    fi
+
+    OUTPUT=$(cat "${MNTPOINT}"/file_c)
+    if [[ "${OUTPUT}" != "${_PARAM}" ]]; then
+        fail "$_TEST_CASE: 写入后立即读文件${MNTPOINT}/file_c, 内容不同"
+        return 1
+    fi
+    return 0
+}
+
+function check_writeback () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    sleep 1
+    umount "${MNTPOINT}"
+    if check_mount; then
+        fail "$_TEST_CASE: $PROJECT_NAME文件系统仍然在挂载点${MNTPOINT}"
+        return 1
+    fi
+    try_mount_or_fail
+
+    OUTPUT=$(cat "${MNTPOINT}"/file_c)
+    if [[ "${OUTPUT}" != "${_PARAM}" ]]; then
+        fail "$_TEST_CASE: 重新挂载后文件${MNTPOINT}/file_c内容不同, 请检查卸载时是否写回了缓存"
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 8.1 - read ${MNTPOINT}/file_c right after writing it"
+touch_and_check "${MNTPOINT}"/file_c
+core_tester echo "$GOLDEN" check_cached_read "$TEST_CASE"
+
+TEST_CASE="case 8.2 - read ${MNTPOINT}/file_c after remount"
+core_tester echo "$GOLDEN" check_writeback "$TEST_CASE"
@@ -0,0 +1,77 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - sequential read"
+
+GOLDEN=$(for i in $(seq 1 100); do echo -n "chunk $i read in small sequential pieces. "; done)
+EXPECTED=$(mktemp)
+ACTUAL=$(mktemp)
+
+function check_prepare () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! echo -n "$_PARAM" | tee "${MNTPOINT}"/file_r "$EXPECTED" > /dev/null; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/file_r失败"
+        return 1
+    fi
+
+    # 重新挂载，之后的读从冷缓存开始
+    sleep 1
+    umount "${MNTPOINT}"
+    if check_mount; then
+        fail "$_TEST_CASE: $PROJECT_NAME文件系统仍然在挂载点${MNTPOINT}"
+        return 1
+    fi
+    try_mount_or_fail
+    return 0
+}
+
+function check_seq_read () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! dd if="${MNTPOINT}"/file_r of="$ACTUAL" bs=256 status=none; then
+        fail "$_TEST_CASE: 顺序读文件${MNTPOINT}/file_r失败"
+        return 1
+    fi
+    if ! cmp -s "$ACTUAL" "$EXPECTED"; then
+        fail "$_TEST_CASE: 顺序读文件${MNTPOINT}/file_r成功, 但内容不同"
+        return 1
+    fi
+    return 0
+}
+
+function check_back_read () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 从尾到头逆序读，预读窗口不应影响非顺序读的结果
+    : > "$ACTUAL"
+    for i in $(seq 16 -1 0); do
+        if ! dd if="${MNTPOINT}"/file_r bs=256 skip="$i" count=1 status=none > "$ACTUAL".blk; then
+            fail "$_TEST_CASE: 逆序读文件${MNTPOINT}/file_r失败"
+            rm -f "$ACTUAL".blk
+            return 1
+        fi
+        cat "$ACTUAL".blk "$ACTUAL" > "$ACTUAL".new
+        mv "$ACTUAL".new "$ACTUAL"
+    done
+    rm -f "$ACTUAL".blk
+    if ! cmp -s "$ACTUAL" "$EXPECTED"; then
+        fail "$_TEST_CASE: 逆序读文件${MNTPOINT}/file_r成功, 但内容不同"
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 10.1 - prepare content of ${MNTPOINT}/file_r and remount"
+touch_and_check "${MNTPOINT}"/file_r
+core_tester echo "$GOLDEN" check_prepare "$TEST_CASE"
+
+TEST_CASE="case 10.2 - read ${MNTPOINT}/file_r sequentially in small pieces"
+core_tester echo "$GOLDEN" check_seq_read "$TEST_CASE"
+
+TEST_CASE="case 10.3 - read ${MNTPOINT}/file_r backwards"
+core_tester echo "$GOLDEN" check_back_read "$TEST_CASE"
+
+rm -f "$EXPECTED" "$ACTUAL"
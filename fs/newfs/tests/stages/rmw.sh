@@ -0,0 +1,65 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - partial block overwrite"
+
+GOLDEN=$(for i in $(seq 1 80); do echo -n "record $i: partial writes must keep the rest of the block. "; done)
+EXPECTED=$(mktemp)
+
+function overwrite () {
+    _FILE=$1
+    # 各为一次写: 跨扇区但不跨块、跨块边界、以及恰好对齐一个扇区
+    head -c 100 /dev/zero | tr '\0' 'A' | dd of="$_FILE" bs=100 seek=1000 oflag=seek_bytes iflag=fullblock conv=notrunc status=none
+    echo -n "BBBBBBBBBB" | dd of="$_FILE" bs=10 seek=2043 oflag=seek_bytes iflag=fullblock conv=notrunc status=none
+    head -c 512 /dev/zero | tr '\0' 'C' | dd of="$_FILE" bs=512 seek=7 iflag=fullblock conv=notrunc status=none
+}
+
+function check_overwrite () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! echo -n "$_PARAM" | tee "${MNTPOINT}"/file_p "$EXPECTED" > /dev/null; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/file_p失败"
+        return 1
+    fi
+    if ! overwrite "${MNTPOINT}"/file_p; then
+        fail "$_TEST_CASE: 覆盖写文件${MNTPOINT}/file_p失败"
+        return 1
+    fi
+    overwrite "$EXPECTED"
+
+    if ! cmp -s "${MNTPOINT}"/file_p "$EXPECTED"; then
+        fail "$_TEST_CASE: 覆盖写后文件${MNTPOINT}/file_p内容不同, 请检查块内未覆盖的部分是否保留"
+        return 1
+    fi
+    return 0
+}
+
+function check_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    sleep 1
+    umount "${MNTPOINT}"
+    if check_mount; then
+        fail "$_TEST_CASE: $PROJECT_NAME文件系统仍然在挂载点${MNTPOINT}"
+        return 1
+    fi
+    try_mount_or_fail
+
+    if ! cmp -s "${MNTPOINT}"/file_p "$EXPECTED"; then
+        fail "$_TEST_CASE: 重新挂载后文件${MNTPOINT}/file_p内容不同"
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 9.1 - overwrite parts of blocks in ${MNTPOINT}/file_p"
+touch_and_check "${MNTPOINT}"/file_p
+core_tester echo "$GOLDEN" check_overwrite "$TEST_CASE"
+
+TEST_CASE="case 9.2 - read ${MNTPOINT}/file_p after remount"
+core_tester echo "$GOLDEN" check_remount "$TEST_CASE"
+
+rm -f "$EXPECTED"
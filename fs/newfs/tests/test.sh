@@ -17,7 +17,7 @@ rm mnt -rf
 mkdir mnt 2>/dev/null 
 
 if [[ "${TEST_METHOD}" == "E" ]]; then
-    ./main.sh "6"
+    ./main.sh "7"
 elif [[ "${TEST_METHOD}" == "N" ]]; then
     ./main.sh "4"
 else
@@ -27,10 +27,11 @@ else
     echo "----测试阶段4：增加 umount 及 remount 测试"
     echo "----测试阶段5：增加 read 及 write 测试"
     echo "----测试阶段6：增加 copy 测试"
-    read -r -p "按照你的进度输入测试等级[数字1-6]: " LEVEL 
-    if [[ "${LEVEL}" -ge "1" ]] && [[ "${LEVEL}" -le "6" ]]; then
+    echo "----测试阶段7：增加缓存写回、部分块覆盖写与顺序读测试"
+    read -r -p "按照你的进度输入测试等级[数字1-7]: " LEVEL 
+    if [[ "${LEVEL}" -ge "1" ]] && [[ "${LEVEL}" -le "7" ]]; then
         ./main.sh "${LEVEL}"
     else
-        echo "!! Wrong Test Level! Please input 1 to 6 !!"
+        echo "!! Wrong Test Level! Please input 1 to 7 !!"
     fi
 fi
\ No newline at end of file
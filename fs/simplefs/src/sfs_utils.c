@@ -50,15 +50,10 @@ int sfs_driver_read(int offset, uint8_t *out_content, int size) {
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
     uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
     // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    if (ddriver_pread(SFS_DRIVER(), temp_content, size_aligned, offset_aligned) < 0) {
+        free(temp_content);
+        return -SFS_ERROR_IO;
     }
     memcpy(out_content, temp_content + bias, size);
     free(temp_content);
@@ -77,18 +72,13 @@ int sfs_driver_write(int offset, uint8_t *in_content, int size) {
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
     uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
     sfs_driver_read(offset_aligned, temp_content, size_aligned);
     memcpy(temp_content + bias, in_content, size);
     
     // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    if (ddriver_pwrite(SFS_DRIVER(), temp_content, size_aligned, offset_aligned) < 0) {
+        free(temp_content);
+        return -SFS_ERROR_IO;
     }
 
     free(temp_content);
@@ -576,11 +566,13 @@ int sfs_mount(struct custom_options options){
  */
 int sfs_umount() {
     struct sfs_super_d  sfs_super_d; 
+    int                 ret = SFS_ERROR_NONE;
 
     if (!sfs_super.is_mounted) {
         return SFS_ERROR_NONE;
     }
 
+    ddriver_plug(SFS_DRIVER());                       /* 刷写期间的写由驱动排序合并 */
     sfs_sync_inode(sfs_super.root_dentry->inode);     /* 从根节点向下刷写节点 */
                                                     
     sfs_super_d.magic_num           = SFS_MAGIC_NUM;
@@ -591,16 +583,20 @@ int sfs_umount() {
 
     if (sfs_driver_write(SFS_SUPER_OFS, (uint8_t *)&sfs_super_d, 
                      sizeof(struct sfs_super_d)) != SFS_ERROR_NONE) {
-        return -SFS_ERROR_IO;
+        ret = -SFS_ERROR_IO;
     }
 
     if (sfs_driver_write(sfs_super_d.map_inode_offset, (uint8_t *)(sfs_super.map_inode), 
                          SFS_BLKS_SZ(sfs_super_d.map_inode_blks)) != SFS_ERROR_NONE) {
-        return -SFS_ERROR_IO;
+        ret = -SFS_ERROR_IO;
+    }
+    // 任一步出错也要unplug，否则已排队的写永远不会下发
+    if (ddriver_unplug(SFS_DRIVER()) < 0) {
+        ret = -SFS_ERROR_IO;
     }
 
     free(sfs_super.map_inode);
     ddriver_close(SFS_DRIVER());
 
-    return SFS_ERROR_NONE;
+    return ret;
 }
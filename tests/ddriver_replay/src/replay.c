@@ -0,0 +1,178 @@
+#include "../include/ddriver.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pwd.h>
+
+/**
+ * 回放由 DDRIVER_TRACE 录制的块IO轨迹
+ * 
+ * 用法: ddriver_replay [-d 设备路径] [-l sleep|virtual|none] [-t] <轨迹文件>
+ *   -d  目标设备，默认 ~/ddriver，轨迹中的写会覆盖其内容
+ *   -l  回放时的延迟模拟方式，默认 virtual
+ *   -t  按录制时的时间间隔发起请求，默认尽快回放
+ */
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s [-d device] [-l sleep|virtual|none] [-t] <trace>\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    char   device[128] = {0};
+    int    lat_mode    = DDRIVER_LAT_VIRTUAL;
+    int    timing      = 0;
+    int    opt, fd, ret, io_sz, status = 0;
+    long long disk_sz, start, elapsed, clock_ns;
+    long long nr_ops = 0, nr_errs = 0;
+    FILE  *tracef;
+    char  *buf     = NULL;
+    char  *new_buf;
+    int    buf_sz  = 0;
+    struct ddriver_trace_hdr hdr;
+    struct ddriver_trace_rec rec;
+    struct ddriver_stats     stats;
+    struct ddriver_discard   range;
+
+    sprintf(device, "%s/ddriver", getpwuid(getuid())->pw_dir);
+    while ((opt = getopt(argc, argv, "d:l:th")) != -1) {
+        switch (opt)
+        {
+        case 'd':
+            strncpy(device, optarg, sizeof(device) - 1);
+            break;
+        case 'l':
+            if (strcmp(optarg, "sleep") == 0) {
+                lat_mode = DDRIVER_LAT_SLEEP;
+            }
+            else if (strcmp(optarg, "none") == 0) {
+                lat_mode = DDRIVER_LAT_NONE;
+            }
+            else {
+                lat_mode = DDRIVER_LAT_VIRTUAL;
+            }
+            break;
+        case 't':
+            timing = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 0;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    /* Cycle 1: open trace and device */
+    tracef = fopen(argv[optind], "r");
+    if (tracef == NULL) {
+        printf("can't open trace %s\n", argv[optind]);
+        return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, tracef) != 1 || hdr.magic != DDRIVER_TRACE_MAGIC
+        || hdr.version != DDRIVER_TRACE_VERSION) {
+        printf("%s is not a ddriver trace\n", argv[optind]);
+        fclose(tracef);
+        return -1;
+    }
+    fd = ddriver_open(device);
+    if (fd < 0) {
+        fclose(tracef);
+        return -1;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_IO_SZ, &io_sz);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE64, &disk_sz);
+    if (io_sz != hdr.iounit_size || disk_sz != hdr.layout_size) {
+        printf("warning: trace recorded on %lld bytes / %d io unit, device is %lld / %d\n",
+               hdr.layout_size, hdr.iounit_size, disk_sz, io_sz);
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_LAT_MODE, &lat_mode);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS_RESET, NULL);
+
+    /* Cycle 2: replay */
+    start = now_ns();
+    while (fread(&rec, sizeof(rec), 1, tracef) == 1) {
+        if (timing) {
+            elapsed = now_ns() - start;
+            if (rec.ts_ns > elapsed) {
+                usleep((rec.ts_ns - elapsed) / 1000);
+            }
+        }
+        if ((rec.op == DDRIVER_OP_READ || rec.op == DDRIVER_OP_WRITE) 
+            && (rec.size <= 0 || rec.size % io_sz != 0 || rec.offset < 0 
+                || rec.size > disk_sz || rec.offset > disk_sz - rec.size)) {
+            printf("bad record %lld: op %d, offset %lld, size %d\n", 
+                   nr_ops, rec.op, rec.offset, rec.size);
+            status = -1;
+            break;
+        }
+        if ((rec.op == DDRIVER_OP_READ || rec.op == DDRIVER_OP_WRITE) && rec.size > buf_sz) {
+            new_buf = realloc(buf, rec.size);
+            if (new_buf == NULL) {
+                printf("can't allocate %d bytes for record %lld\n", rec.size, nr_ops);
+                status = -1;
+                break;
+            }
+            buf    = new_buf;
+            buf_sz = rec.size;
+            memset(buf, 0, buf_sz);
+        }
+        switch (rec.op)
+        {
+        case DDRIVER_OP_SEEK:
+            ret = ddriver_seek(fd, rec.offset, SEEK_SET) < 0 ? -1 : 0;
+            break;
+        case DDRIVER_OP_READ:
+            ret = ddriver_pread(fd, buf, rec.size, rec.offset);
+            break;
+        case DDRIVER_OP_WRITE:
+            ret = ddriver_pwrite(fd, buf, rec.size, rec.offset);
+            break;
+        case DDRIVER_OP_DISCARD:
+            range.offset = rec.offset;
+            range.len    = rec.size;
+            ret = ddriver_ioctl(fd, IOC_REQ_DEVICE_DISCARD, &range);
+            break;
+        default:
+            ret = -1;
+            break;
+        }
+        nr_ops++;
+        if (ret < 0) {
+            nr_errs++;
+        }
+    }
+    elapsed = now_ns() - start;
+
+    /* Cycle 3: report */
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &clock_ns);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats);
+    printf("ops: %lld, errors: %lld\n", nr_ops, nr_errs);
+    printf("wall time: %.3f ms\n", elapsed / 1e6);
+    printf("modeled disk time: %.3f ms\n", clock_ns / 1e6);
+    printf("read: %lld ops, %lld bytes, %.3f ms\n", stats.read_ops, stats.read_bytes, stats.read_ns / 1e6);
+    printf("write: %lld ops, %lld bytes, %.3f ms\n", stats.write_ops, stats.write_bytes, stats.write_ns / 1e6);
+    printf("discard: %lld ops, %lld bytes\n", stats.discard_ops, stats.discard_bytes);
+    printf("seek: %lld ops, %lld bytes travelled\n", stats.seek_ops, stats.seek_distance);
+    printf("sequential: %lld, random: %lld\n", stats.seq_ops, stats.rand_ops);
+    if (stats.flash_prog_bytes > 0) {
+        printf("flash: %lld page reads, %lld bytes programmed, write amplification %.2f\n", 
+               stats.flash_read_pages, stats.flash_prog_bytes, 
+               stats.write_bytes ? (double)stats.flash_prog_bytes / stats.write_bytes : 0.0);
+        printf("flash gc: %lld pages moved, %lld erases, %.3f ms stalled\n", 
+               stats.flash_gc_pages, stats.flash_erases, stats.flash_gc_ns / 1e6);
+    }
+
+    free(buf);
+    fclose(tracef);
+    ddriver_close(fd);
+    return status;
+}
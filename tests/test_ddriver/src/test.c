@@ -1,11 +1,43 @@
 #include "../include/ddriver.h"
 #include <linux/fs.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define DEVICE_PATH "/home/students/200110530/ddriver"
+
+/* Used by Cycle 20: each thread writes and verifies its own region with positional I/O */
+struct thread_arg
+{
+    int  fd;
+    int  id;
+    int  ok;
+};
+
+void* thread_rw(void *arg) {
+    struct thread_arg *targ = (struct thread_arg *)arg;
+    char wbuf[512], rbuf[512];
+    off_t offset;
+    int i;
+
+    targ->ok = 1;
+    for (i = 0; i < 64; i++) {
+        offset = (1024 + targ->id * 64 + i) * 512;
+        memset(wbuf, 'a' + (targ->id + i) % 26, 512);
+        if (ddriver_pwrite(targ->fd, wbuf, 512, offset) != 512 
+            || ddriver_pread(targ->fd, rbuf, 512, offset) != 512 || memcmp(wbuf, rbuf, 512) != 0) {
+            targ->ok = 0;
+        }
+    }
+    return NULL;
+}
 
 int main(int argc, char const *argv[])
 {
     int size;
     struct ddriver_state state;
-    int fd = ddriver_open("/home/students/200110530/ddriver");
+    int fd = ddriver_open(DEVICE_PATH);
     if (fd < 0) {
         return -1;
     }
@@ -44,6 +76,526 @@ int main(int argc, char const *argv[])
     printf("write_cnt: %d\n", state.write_cnt);
     printf("seek_cnt: %d\n", state.seek_cnt);
 
+    /* Cycle 5: plug test - sequential ddriver_write must advance the head */
+    memset(buffer, 'A', 512);
+    memset(rbuffer, 'B', 512);
+    ddriver_seek(fd, 0, SEEK_SET);
+    ddriver_plug(fd);
+    ddriver_write(fd, buffer, 512);
+    ddriver_write(fd, rbuffer, 512);
+    ddriver_unplug(fd);
+    ddriver_seek(fd, 0, SEEK_SET);
+    ddriver_read(fd, buffer, 512);
+    ddriver_read(fd, rbuffer, 512);
+    printf("plug: sec0=%c sec1=%c\n", buffer[0], rbuffer[0]);
+    if (buffer[0] != 'A' || rbuffer[0] != 'B') {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 6: write cache test - writes absorbed by the cache must advance the head */
+    long long wcache = 64 * 1024;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_WCACHE, &wcache);
+    memset(buffer, 'C', 512);
+    memset(rbuffer, 'D', 512);
+    ddriver_seek(fd, 0, SEEK_SET);
+    ddriver_write(fd, buffer, 512);
+    ddriver_write(fd, rbuffer, 512);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_FLUSH, NULL);
+    ddriver_seek(fd, 0, SEEK_SET);
+    ddriver_read(fd, buffer, 512);
+    ddriver_read(fd, rbuffer, 512);
+    printf("wcache: sec0=%c sec1=%c\n", buffer[0], rbuffer[0]);
+    wcache = 0;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_WCACHE, &wcache);
+    if (buffer[0] != 'C' || rbuffer[0] != 'D') {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 7: readv/writev test - one multi-block write read back block by block, and back */
+    char vbuffer[4 * 512];
+    char rvbuffer[4 * 512];
+    int i, ret;
+    for (i = 0; i < 4; i++) {
+        memset(vbuffer + i * 512, 'a' + i, 512);
+    }
+    ddriver_seek(fd, 0, SEEK_SET);
+    if (ddriver_writev(fd, vbuffer, sizeof(vbuffer)) != sizeof(vbuffer)) {
+        ddriver_close(fd);
+        return -1;
+    }
+    ddriver_seek(fd, 0, SEEK_SET);
+    for (i = 0; i < 4; i++) {
+        ddriver_read(fd, rvbuffer + i * 512, 512);
+    }
+    printf("writev: sec0=%c sec3=%c\n", rvbuffer[0], rvbuffer[3 * 512]);
+    if (memcmp(vbuffer, rvbuffer, sizeof(vbuffer)) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+    memset(rvbuffer, 0, sizeof(rvbuffer));
+    ddriver_seek(fd, 0, SEEK_SET);
+    if (ddriver_readv(fd, rvbuffer, sizeof(rvbuffer)) != sizeof(rvbuffer)
+        || memcmp(vbuffer, rvbuffer, sizeof(vbuffer)) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 8: pread/pwrite test - positional write read back through the head, head ends after it */
+    memset(buffer, 'P', 512);
+    if (ddriver_pwrite(fd, buffer, 512, 8 * 512) != 512) {
+        ddriver_close(fd);
+        return -1;
+    }
+    if (ddriver_seek(fd, 0, SEEK_CUR) != 9 * 512) {
+        ddriver_close(fd);
+        return -1;
+    }
+    ddriver_seek(fd, 8 * 512, SEEK_SET);
+    ddriver_read(fd, rbuffer, 512);
+    printf("pwrite: sec8=%c\n", rbuffer[0]);
+    if (memcmp(buffer, rbuffer, 512) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+    memset(rbuffer, 0, 512);
+    if (ddriver_pread(fd, rbuffer, 512, 8 * 512) != 512 || memcmp(buffer, rbuffer, 512) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 9: mmap backend test - data written by one backend is seen by the other */
+    int backend = DDRIVER_BACKEND_MMAP;
+    memset(buffer, 'M', 512);
+    ddriver_pwrite(fd, buffer, 512, 16 * 512);
+    if (ddriver_ioctl(fd, IOC_REQ_DEVICE_BACKEND, &backend) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+    ddriver_pread(fd, rbuffer, 512, 16 * 512);
+    memset(buffer, 'N', 512);
+    ddriver_pwrite(fd, buffer, 512, 17 * 512);
+    backend = DDRIVER_BACKEND_FILE;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_BACKEND, &backend);
+    printf("mmap: sec16=%c\n", rbuffer[0]);
+    if (rbuffer[0] != 'M') {
+        ddriver_close(fd);
+        return -1;
+    }
+    ddriver_pread(fd, rbuffer, 512, 17 * 512);
+    printf("file: sec17=%c\n", rbuffer[0]);
+    if (memcmp(buffer, rbuffer, 512) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 10: aio test - asynchronous writes read back synchronously */
+    struct ddriver_io  ios[4];
+    struct ddriver_io *iop[4];
+    struct ddriver_io *events[4];
+    int done = 0;
+    for (i = 0; i < 4; i++) {
+        memset(vbuffer + i * 512, 'w' + i, 512);
+        memset(&ios[i], 0, sizeof(ios[i]));
+        ios[i].op     = DDRIVER_OP_WRITE;
+        ios[i].buf    = vbuffer + i * 512;
+        ios[i].size   = 512;
+        ios[i].offset = (24 + i) * 512;
+        iop[i] = &ios[i];
+    }
+    if (ddriver_submit(fd, iop, 4) != 4) {
+        ddriver_close(fd);
+        return -1;
+    }
+    while (done < 4) {
+        done += ddriver_getevents(fd, 1, 4 - done, events + done);
+    }
+    for (i = 0; i < 4; i++) {
+        if (ios[i].res != 512 || ios[i].complete_ns < ios[i].submit_ns) {
+            ddriver_close(fd);
+            return -1;
+        }
+    }
+    ddriver_pread(fd, rvbuffer, sizeof(rvbuffer), 24 * 512);
+    printf("aio: sec24=%c sec27=%c\n", rvbuffer[0], rvbuffer[3 * 512]);
+    if (memcmp(vbuffer, rvbuffer, sizeof(vbuffer)) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 11: geometry test - a multi-GB image set at open serves I/O past 2GiB */
+    long long disk_sz, size64, big_sz = 3LL << 30;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE64, &disk_sz);
+    ddriver_close(fd);
+    setenv("DDRIVER_DISK_SZ", "3G", 1);
+    fd = ddriver_open(DEVICE_PATH);
+    unsetenv("DDRIVER_DISK_SZ");
+    if (fd < 0) {
+        return -1;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE64, &size64);
+    memset(buffer, 'G', 512);
+    ddriver_pwrite(fd, buffer, 512, big_sz - 512);
+    memset(rbuffer, 0, 512);
+    ddriver_seek(fd, big_sz - 512, SEEK_SET);
+    ddriver_read(fd, rbuffer, 512);
+    ddriver_close(fd);
+    printf("geometry: size=%lld last=%c\n", size64, rbuffer[0]);
+    if (truncate(DEVICE_PATH, disk_sz) < 0 || size64 != big_sz || rbuffer[0] != 'G') {
+        return -1;
+    }
+    fd = ddriver_open(DEVICE_PATH);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* Cycle 12: virtual clock test - I/O advances the clock only when latency is modeled */
+    long long clock0, clock1, clock2;
+    int lat_mode = DDRIVER_LAT_VIRTUAL;
+    setenv("DDRIVER_LATENCY", "virtual", 1);          /* later reopens don't sleep either */
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_LAT_MODE, &lat_mode);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &clock0);
+    ddriver_pread(fd, rbuffer, 512, 512 * 512);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &clock1);
+    lat_mode = DDRIVER_LAT_NONE;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_LAT_MODE, &lat_mode);
+    ddriver_pread(fd, rbuffer, 512, 0);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &clock2);
+    lat_mode = DDRIVER_LAT_VIRTUAL;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_LAT_MODE, &lat_mode);
+    printf("clock: %lld -> %lld -> %lld ns\n", clock0, clock1, clock2);
+    if (clock1 <= clock0 || clock2 != clock1) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 13: stats test - counters follow the requests issued since the reset */
+    struct ddriver_stats stats, stats2;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS_RESET, NULL);
+    ddriver_pwrite(fd, buffer, 512, 64 * 512);
+    ddriver_pread(fd, vbuffer, 2 * 512, 64 * 512);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &clock0);
+    printf("stats: read %lld/%lld write %lld/%lld clock %lld\n", stats.read_ops, stats.read_bytes,
+           stats.write_ops, stats.write_bytes, clock0);
+    if (stats.read_ops != 1 || stats.read_bytes != 2 * 512 || stats.write_ops != 1
+        || stats.write_bytes != 512 || stats.read_ns <= 0 || stats.write_ns <= 0 || clock0 <= 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 14: trace test - a recorded write shows up in the trace file */
+    struct ddriver_trace_hdr hdr;
+    struct ddriver_trace_rec rec;
+    FILE *tracef;
+    int found = 0;
+    memset(&hdr, 0, sizeof(hdr));
+    ddriver_close(fd);
+    setenv("DDRIVER_TRACE", DEVICE_PATH ".trace", 1);
+    fd = ddriver_open(DEVICE_PATH);
+    unsetenv("DDRIVER_TRACE");
+    if (fd < 0) {
+        return -1;
+    }
+    ddriver_pwrite(fd, buffer, 512, 72 * 512);
+    ddriver_close(fd);
+    tracef = fopen(DEVICE_PATH ".trace", "r");
+    if (tracef == NULL) {
+        return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, tracef) == 1 && hdr.magic == DDRIVER_TRACE_MAGIC) {
+        while (fread(&rec, sizeof(rec), 1, tracef) == 1) {
+            if (rec.op == DDRIVER_OP_WRITE && rec.offset == 72 * 512 && rec.size == 512) {
+                found = 1;
+            }
+        }
+    }
+    fclose(tracef);
+    remove(DEVICE_PATH ".trace");
+    printf("trace: magic=%x write found=%d\n", hdr.magic, found);
+    if (!found) {
+        return -1;
+    }
+    fd = ddriver_open(DEVICE_PATH);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* Cycle 15: plug merge test - adjacent plugged writes reach the disk as one request */
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS_RESET, NULL);
+    ddriver_plug(fd);
+    for (i = 3; i >= 0; i--) {
+        ddriver_pwrite(fd, vbuffer + i * 512, 512, (80 + i) * 512);
+    }
+    ddriver_pread(fd, rbuffer, 512, 81 * 512);        /* served from the queue */
+    ddriver_unplug(fd);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats);
+    ddriver_pread(fd, rvbuffer, sizeof(rvbuffer), 80 * 512);
+    printf("plug merge: write_ops=%lld read_ops=%lld\n", stats.write_ops, stats.read_ops);
+    if (stats.write_ops != 1 || stats.read_ops != 0 || memcmp(rbuffer, vbuffer + 512, 512) != 0
+        || memcmp(vbuffer, rvbuffer, sizeof(vbuffer)) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 16: stripe test - data survives a reopen and alternates between the members */
+    static char sbuffer[4 * 4096];
+    static char rsbuffer[4 * 4096];
+    FILE *memberf;
+    for (i = 0; i < (int)sizeof(sbuffer); i++) {
+        sbuffer[i] = 'A' + i / 512 % 26;
+    }
+    ddriver_close(fd);
+    setenv("DDRIVER_STRIPE", "2", 1);
+    setenv("DDRIVER_STRIPE_UNIT", "4K", 1);
+    fd = ddriver_open(DEVICE_PATH);
+    if (fd < 0) {
+        return -1;
+    }
+    ddriver_pwrite(fd, sbuffer, sizeof(sbuffer), 0);
+    ddriver_close(fd);
+    fd = ddriver_open(DEVICE_PATH);
+    unsetenv("DDRIVER_STRIPE");
+    unsetenv("DDRIVER_STRIPE_UNIT");
+    if (fd < 0) {
+        return -1;
+    }
+    ddriver_pread(fd, rsbuffer, sizeof(rsbuffer), 0);
+    ddriver_close(fd);
+    memberf = fopen(DEVICE_PATH ".1", "r");           /* 2nd stripe unit is the start of member 1 */
+    memset(rbuffer, 0, 512);
+    if (memberf != NULL) {
+        if (fread(rbuffer, 512, 1, memberf) != 1) {
+            rbuffer[0] = 0;
+        }
+        fclose(memberf);
+    }
+    remove(DEVICE_PATH ".0");
+    remove(DEVICE_PATH ".1");
+    printf("stripe: unit1=%c member1=%c\n", rsbuffer[4096], rbuffer[0]);
+    if (memcmp(sbuffer, rsbuffer, sizeof(sbuffer)) != 0 || memcmp(rbuffer, sbuffer + 4096, 512) != 0) {
+        return -1;
+    }
+    fd = ddriver_open(DEVICE_PATH);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* Cycle 17: discard test - a discarded range reads back as zeros, its neighbours survive */
+    struct ddriver_discard range;
+    char zero[512] = {0};
+    memset(buffer, 'T', 512);
+    ddriver_pwrite(fd, buffer, 512, 96 * 512);
+    ddriver_pwrite(fd, buffer, 512, 97 * 512);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS_RESET, NULL);
+    range.offset = 96 * 512;
+    range.len    = 512;
+    if (ddriver_ioctl(fd, IOC_REQ_DEVICE_DISCARD, &range) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+    ddriver_pread(fd, vbuffer, 2 * 512, 96 * 512);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats);
+    printf("discard: sec96=%d sec97=%c ops=%lld\n", vbuffer[0], vbuffer[512], stats.discard_ops);
+    if (memcmp(vbuffer, zero, 512) != 0 || memcmp(vbuffer + 512, buffer, 512) != 0
+        || stats.discard_ops != 1 || stats.discard_bytes != 512) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 18: reset-from test - the device holds the template and nothing else afterwards */
+    FILE *tmplf = fopen(DEVICE_PATH ".tmpl", "w");
+    if (tmplf == NULL) {
+        ddriver_close(fd);
+        return -1;
+    }
+    fwrite(buffer, 512, 1, tmplf);
+    fwrite(zero, 512, 1, tmplf);
+    fclose(tmplf);
+    ddriver_pwrite(fd, sbuffer, 512, 200 * 512);
+    ret = ddriver_ioctl(fd, IOC_REQ_DEVICE_RESET_FROM, DEVICE_PATH ".tmpl");
+    remove(DEVICE_PATH ".tmpl");
+    ddriver_pread(fd, vbuffer, 512, 0);
+    ddriver_pread(fd, rbuffer, 512, 200 * 512);
+    printf("reset from: sec0=%c sec200=%d\n", vbuffer[0], rbuffer[0]);
+    if (ret != 0 || memcmp(vbuffer, buffer, 512) != 0 || memcmp(rbuffer, zero, 512) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 19: FUA test - a FUA write bypasses the write cache, a plain one is absorbed */
+    wcache = 64 * 1024;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_WCACHE, &wcache);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS_RESET, NULL);
+    memset(buffer, 'F', 512);
+    ddriver_pwrite2(fd, buffer, 512, 104 * 512, DDRIVER_WRITE_FUA);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats);
+    ddriver_pwrite2(fd, buffer, 512, 105 * 512, 0);
+    ddriver_pread(fd, vbuffer, 2 * 512, 104 * 512);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats2);
+    wcache = 0;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_WCACHE, &wcache);
+    printf("fua: writes=%lld cached=%lld, then writes=%lld cached=%lld\n", stats.write_ops,
+           stats.cached_writes, stats2.write_ops, stats2.cached_writes);
+    if (stats.write_ops != 1 || stats.cached_writes != 0 || stats2.write_ops != 1
+        || stats2.cached_writes != 1 || memcmp(vbuffer, buffer, 512) != 0
+        || memcmp(vbuffer + 512, buffer, 512) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 20: thread test - concurrent positional I/O on one handle */
+    pthread_t threads[4];
+    struct thread_arg targs[4];
+    for (i = 0; i < 4; i++) {
+        targs[i].fd = fd;
+        targs[i].id = i;
+        pthread_create(&threads[i], NULL, thread_rw, &targs[i]);
+    }
+    for (i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (i = 0; i < 4; i++) {
+        if (!targs[i].ok) {
+            printf("threads: thread %d saw a mismatch\n", i);
+            ddriver_close(fd);
+            return -1;
+        }
+    }
+    printf("threads: ok\n");
+
+    /* Cycle 21: ssd test - data survives garbage collection after the device is overwritten */
+    int pass, ok = 1;
+    ddriver_close(fd);
+    setenv("DDRIVER_MODEL", "ssd", 1);
+    setenv("DDRIVER_DISK_SZ", "1M", 1);
+    setenv("DDRIVER_FLASH_BLOCK", "16K", 1);
+    fd = ddriver_open(DEVICE_PATH);
+    unsetenv("DDRIVER_MODEL");
+    unsetenv("DDRIVER_DISK_SZ");
+    unsetenv("DDRIVER_FLASH_BLOCK");
+    if (fd < 0) {
+        return -1;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS_RESET, NULL);
+    for (pass = 0; pass < 4; pass++) {               /* fill, then keep rewriting every other page */
+        for (i = 0; i < 256; i += pass == 0 ? 1 : 2) {
+            memset(sbuffer, 'a' + (pass + i) % 26, 4096);
+            ddriver_pwrite(fd, sbuffer, 4096, (off_t)i * 4096);
+        }
+    }
+    for (i = 0; i < 256; i++) {
+        memset(sbuffer, 'a' + ((i % 2 ? 0 : 3) + i) % 26, 4096);
+        ddriver_pread(fd, rsbuffer, 4096, (off_t)i * 4096);
+        if (memcmp(sbuffer, rsbuffer, 4096) != 0) {
+            ok = 0;
+        }
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats);
+    ddriver_close(fd);
+    printf("ssd: erases=%lld gc pages=%lld data ok=%d\n", stats.flash_erases, stats.flash_gc_pages, ok);
+    if (!ok || stats.flash_erases <= 0 || stats.flash_gc_pages <= 0) {
+        return -1;
+    }
+    fd = ddriver_open(DEVICE_PATH);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* Cycle 22: NCQ test - the request nearest to the head is served first (SPTF) */
+    ddriver_close(fd);
+    setenv("DDRIVER_NCQ", "1", 1);
+    fd = ddriver_open(DEVICE_PATH);
+    if (fd < 0) {
+        return -1;
+    }
+    ddriver_pread(fd, rbuffer, 512, 0);               /* head is now at sector 1 */
+    for (i = 0; i < 2; i++) {
+        memset(&ios[i], 0, sizeof(ios[i]));
+        ios[i].op   = DDRIVER_OP_READ;
+        ios[i].buf  = vbuffer + i * 512;
+        ios[i].size = 512;
+        iop[i] = &ios[i];
+    }
+    ios[0].offset = 64 * 512;                         /* submitted first but far away */
+    ios[1].offset = 512;
+    ddriver_submit(fd, iop, 2);                       /* the queue reads DDRIVER_NCQ when it starts */
+    unsetenv("DDRIVER_NCQ");
+    done = 0;
+    while (done < 2) {
+        done += ddriver_getevents(fd, 1, 2 - done, events + done);
+    }
+    printf("ncq: first served %s\n", events[0] == &ios[1] ? "near" : "far");
+    if (events[0] != &ios[1] || ios[1].complete_ns >= ios[0].complete_ns
+        || ios[0].res != 512 || ios[1].res != 512) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 23: shm test - handles share the segment, the last close writes it back */
+    int fd2;
+    ddriver_close(fd);
+    setenv("DDRIVER_BACKEND", "shm", 1);
+    fd  = ddriver_open(DEVICE_PATH);
+    fd2 = ddriver_open(DEVICE_PATH);
+    unsetenv("DDRIVER_BACKEND");
+    if (fd < 0 || fd2 < 0) {
+        return -1;
+    }
+    memset(buffer, 'S', 512);
+    ddriver_pwrite(fd, buffer, 512, 112 * 512);
+    ddriver_pread(fd2, rbuffer, 512, 112 * 512);
+    ddriver_close(fd2);
+    ddriver_close(fd);
+    printf("shm: sec112=%c\n", rbuffer[0]);
+    if (memcmp(buffer, rbuffer, 512) != 0) {
+        return -1;
+    }
+    fd = ddriver_open(DEVICE_PATH);
+    if (fd < 0) {
+        return -1;
+    }
+    ddriver_pread(fd, rbuffer, 512, 112 * 512);
+    printf("shm: written back sec112=%c\n", rbuffer[0]);
+    if (memcmp(buffer, rbuffer, 512) != 0) {
+        ddriver_close(fd);
+        return -1;
+    }
+
+    /* Cycle 24: log test - a warning reaches the log file once the last handle is closed */
+    FILE *logf;
+    long log_sz = 0;
+    char line[256] = {0};
+    logf = fopen(DEVICE_PATH "_log", "r");
+    if (logf != NULL) {
+        fseek(logf, 0, SEEK_END);
+        log_sz = ftell(logf);
+        fclose(logf);
+    }
+    if (ddriver_seek(fd, 1, SEEK_SET) >= 0) {         /* unaligned, logged as a warning */
+        ddriver_close(fd);
+        return -1;
+    }
+    ddriver_close(fd);
+    logf = fopen(DEVICE_PATH "_log", "r");
+    if (logf == NULL) {
+        return -1;
+    }
+    fseek(logf, log_sz, SEEK_SET);
+    if (fread(line, 1, sizeof(line) - 1, logf) == 0) {
+        line[0] = '\0';
+    }
+    fclose(logf);
+    printf("log: %s", line);
+    if (strstr(line, "must be aligned") == NULL) {
+        return -1;
+    }
+    fd = ddriver_open(DEVICE_PATH);
+    if (fd < 0) {
+        return -1;
+    }
+
     ddriver_close(fd);
 
     printf("Test Pass :)\n");